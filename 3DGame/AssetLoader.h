@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Loads assets in the background. An asset's prepare() (file reading,
+// parsing, image decoding) runs on a worker thread; its upload() needs the
+// GL context, so finished assets queue up until the render thread calls
+// drainUploads(), which runs as many as fit in the given time budget.
+class AssetLoader
+{
+    struct Job
+    {
+        std::function<void()> prepare;
+        std::function<void()> upload;
+    };
+    std::deque<Job> pending;
+    std::deque<std::function<void()> > uploads;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    unsigned int threadCount;
+    unsigned int inFlight;
+    bool stopping;
+
+    void work()
+    {
+        for(;;){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while(pending.empty() && !stopping)
+                    wake.wait(lock);
+                if(stopping)
+                    return;
+                job = pending.front();
+                pending.pop_front();
+            }
+            job.prepare();
+            std::lock_guard<std::mutex> lock(mutex);
+            uploads.push_back(job.upload);
+        }
+    }
+
+public:
+    AssetLoader(unsigned int threadCount = 2):threadCount(threadCount),inFlight(0),stopping(false){}
+    ~AssetLoader(){ shutdown(); }
+
+    template <class T>
+    void load(T* asset)
+    {
+        Job job;
+        job.prepare = [asset]{ asset->prepare(); };
+        job.upload = [asset]{ asset->upload(); };
+        std::lock_guard<std::mutex> lock(mutex);
+        if(workers.empty() && !stopping)
+            for(unsigned int i = 0; i < threadCount; i++)
+                workers.push_back(std::thread(&AssetLoader::work, this));
+        pending.push_back(job);
+        inFlight++;
+        wake.notify_one();
+    }
+
+    // call on the GL thread once per frame; always uploads at least one asset if any is waiting
+    void drainUploads(double budgetMs)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        for(;;){
+            std::function<void()> upload;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(uploads.empty())
+                    return;
+                upload = uploads.front();
+                uploads.pop_front();
+                inFlight--;
+            }
+            upload();
+            if(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() > budgetMs)
+                return;
+        }
+    }
+
+    // for runs without a GL context: waits for every prepare() and drops the
+    // uploads, the assets stay not ready
+    void discardUploads()
+    {
+        for(;;){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                inFlight -= uploads.size();
+                uploads.clear();
+                if(inFlight == 0)
+                    return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    bool isIdle()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return inFlight == 0;
+    }
+
+    // drops jobs that have not started and waits for the workers, before the assets go away
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            pending.clear();
+        }
+        wake.notify_all();
+        for(unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+        workers.clear();
+    }
+};
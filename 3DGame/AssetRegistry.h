@@ -0,0 +1,90 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include "AssetLoader.h"
+
+// Process-wide store of assets loaded from disk, keyed by path. acquire()
+// loads an asset the first time and hands out the resident copy afterwards,
+// release() drops a reference. Unreferenced assets stay resident (a new game
+// will ask for them again) until purgeUnused() is called.
+// With a loader, a new asset is returned at once and loads in the background
+// (check isReady()); without one it is prepared and uploaded on the spot.
+template <class T>
+class AssetRegistry
+{
+    struct Entry
+    {
+        T* asset;
+        int references;
+    };
+    std::map<std::string, Entry> entries;
+    AssetLoader* loader;
+    unsigned int hits;
+    unsigned int misses;
+
+public:
+    AssetRegistry(AssetLoader* loader = NULL):loader(loader),hits(0),misses(0){}
+
+    ~AssetRegistry()
+    {
+        if(loader)
+            loader->shutdown();
+        for(typename std::map<std::string, Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+            delete i->second.asset;
+    }
+
+    T* acquire(const char* path)
+    {
+        typename std::map<std::string, Entry>::iterator i = entries.find(path);
+        if(i != entries.end()){
+            hits++;
+            i->second.references++;
+            return i->second.asset;
+        }
+        misses++;
+        Entry e;
+        e.asset = new T(path);
+        e.references = 1;
+        entries[path] = e;
+        if(loader)
+            loader->load(e.asset);
+        else{
+            e.asset->prepare();
+            e.asset->upload();
+        }
+        return e.asset;
+    }
+
+    // returns false if the asset did not come from this registry
+    template <class Base>
+    bool release(Base* asset)
+    {
+        for(typename std::map<std::string, Entry>::iterator i = entries.begin(); i != entries.end(); ++i){
+            if(static_cast<Base*>(i->second.asset) == asset){
+                if(i->second.references > 0)
+                    i->second.references--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // assets still loading are kept, a worker may be filling them in
+    void purgeUnused()
+    {
+        typename std::map<std::string, Entry>::iterator i = entries.begin();
+        while(i != entries.end()){
+            if(i->second.references == 0 && i->second.asset->isReady()){
+                delete i->second.asset;
+                entries.erase(i++);
+            }
+            else
+                ++i;
+        }
+    }
+
+    unsigned int getHits() const { return hits; }
+    unsigned int getMisses() const { return misses; }
+    unsigned int getResidentCount() const { return entries.size(); }
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <vector>
+#include <math.h>
+#include "float3.h"
+#include "SeekerKernel.h"
+
+// A float3 component kept as one array per coordinate, so the SIMD kernels
+// read runs of x, y and z straight from the store. An element is reached
+// through a Float3Ref, which reads and writes like a float3.
+struct Float3Ref
+{
+    float& x;
+    float& y;
+    float& z;
+
+    Float3Ref(float& x, float& y, float& z):x(x),y(y),z(z){}
+    operator float3() const { return float3(x, y, z); }
+    Float3Ref& operator=(const float3& v){ x = v.x; y = v.y; z = v.z; return *this; }
+    Float3Ref& operator=(const Float3Ref& v){ return *this = (float3)v; }
+    void operator+=(const float3& v){ x += v.x; y += v.y; z += v.z; }
+    float3 operator+(const float3& v) const { return float3(x + v.x, y + v.y, z + v.z); }
+    float3 operator-(const float3& v) const { return float3(x - v.x, y - v.y, z - v.z); }
+    float3 operator*(float s) const { return float3(x * s, y * s, z * s); }
+};
+
+class Float3Array
+{
+public:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    Float3Ref operator[](unsigned int i){ return Float3Ref(x[i], y[i], z[i]); }
+    float3 operator[](unsigned int i) const { return float3(x[i], y[i], z[i]); }
+    float3 back() const { return (*this)[x.size() - 1]; }
+    unsigned int size() const { return x.size(); }
+    void push_back(const float3& v){ x.push_back(v.x); y.push_back(v.y); z.push_back(v.z); }
+    void pop_back(){ x.pop_back(); y.pop_back(); z.pop_back(); }
+    void clear(){ x.clear(); y.clear(); z.clear(); }
+};
+
+// Simulation state of every object in the scene, one array per component
+// so the per-tick systems below walk memory linearly instead of calling a
+// virtual move() on each heap-allocated Object. An entity is an index into
+// the arrays; destroy() moves the last entity into the hole and updates the
+// index its owner holds through the handle given to create().
+class EntityStore
+{
+public:
+    // which system moves the entity; Custom ones move themselves
+    enum Kind { Static, Custom, Seeker, Bullet, Bouncer };
+    enum Flag { Enemy = 1, Hazard = 2, Teapot = 4, Avatar = 8, Dead = 16 };
+
+    Float3Array position;
+    Float3Array previousPosition;           // at the start of the last step, drawing blends from it
+    Float3Array velocity;
+    std::vector<float3> scale;
+    std::vector<float> orientation;         // degrees about y
+    std::vector<float> previousOrientation;
+    std::vector<float> angularVelocity;
+    std::vector<float> timeDead;            // seconds since the Dead flag was set
+    std::vector<unsigned char> kind;
+    std::vector<unsigned char> flags;
+
+private:
+    std::vector<unsigned int*> handles;
+    SeekerKernelPath seekerKernel;
+
+    template <class C>
+    static void moveLast(C& component, unsigned int to)
+    {
+        component[to] = component.back();
+        component.pop_back();
+    }
+
+public:
+    EntityStore():seekerKernel(bestSeekerKernel()){}
+
+    void setSeekerKernel(SeekerKernelPath path){ seekerKernel = path; }
+    SeekerKernelPath getSeekerKernel() const { return seekerKernel; }
+
+    unsigned int size() const { return position.size(); }
+
+    unsigned int create(Kind k, unsigned int* handle)
+    {
+        position.push_back(float3());
+        previousPosition.push_back(float3());
+        velocity.push_back(float3());
+        scale.push_back(float3(1, 1, 1));
+        orientation.push_back(0);
+        previousOrientation.push_back(0);
+        angularVelocity.push_back(0);
+        timeDead.push_back(0);
+        kind.push_back(k);
+        flags.push_back(0);
+        handles.push_back(handle);
+        *handle = position.size() - 1;
+        return *handle;
+    }
+
+    void destroy(unsigned int e)
+    {
+        moveLast(position, e);
+        moveLast(previousPosition, e);
+        moveLast(velocity, e);
+        moveLast(scale, e);
+        moveLast(orientation, e);
+        moveLast(previousOrientation, e);
+        moveLast(angularVelocity, e);
+        moveLast(timeDead, e);
+        moveLast(kind, e);
+        moveLast(flags, e);
+        moveLast(handles, e);
+        if(e < handles.size())
+            *handles[e] = e;
+    }
+
+    // drops every entity at once; the handles given to create() are not touched
+    void clear()
+    {
+        position.clear();
+        previousPosition.clear();
+        velocity.clear();
+        scale.clear();
+        orientation.clear();
+        previousOrientation.clear();
+        angularVelocity.clear();
+        timeDead.clear();
+        kind.clear();
+        flags.clear();
+        handles.clear();
+    }
+
+    void savePreviousState()
+    {
+        previousPosition = position;
+        previousOrientation = orientation;
+    }
+
+    // run towards target at speed and face it; corpses keep turning but stay put.
+    // The kernel works on the store's arrays in place, skipping other kinds
+    void steerSeekers(float3 target, float speed, float dt)
+    {
+        SeekerBatch batch;
+        batch.x = position.x.data();
+        batch.y = position.y.data();
+        batch.z = position.z.data();
+        batch.vx = velocity.x.data();
+        batch.vy = velocity.y.data();
+        batch.vz = velocity.z.data();
+        batch.heading = orientation.data();
+        batch.kind = kind.data();
+        batch.flags = flags.data();
+        batch.seekerKind = Seeker;
+        batch.deadFlag = Dead;
+        batch.count = size();
+        ::steerSeekers(batch, target, speed, dt, seekerKernel);
+    }
+
+    void integrateBullets(float dt)
+    {
+        for(unsigned int e = 0; e < kind.size(); e++)
+            if(kind[e] == Bullet)
+                position[e] += velocity[e] * dt;
+    }
+
+    // gravity, a bounce off the ground and spin that dies down
+    void bounceBouncers(float dt, float restitution)
+    {
+        float spinDecay = pow(0.8, dt);
+        for(unsigned int e = 0; e < kind.size(); e++){
+            if(kind[e] != Bouncer)
+                continue;
+            position[e] += velocity[e] * dt;
+            velocity[e] += float3(0, -10, 0) * dt;
+            orientation[e] += angularVelocity[e] * dt;
+            if(position[e].y < 0){
+                velocity[e].y *= -restitution;
+                position[e].y = 0;
+            }
+            angularVelocity[e] *= spinDecay;
+        }
+    }
+
+    void ageCorpses(float dt)
+    {
+        for(unsigned int e = 0; e < flags.size(); e++)
+            if(flags[e] & Dead)
+                timeDead[e] += dt;
+    }
+
+    // bullets leaving the arena die; seekers and bouncers are put back on the
+    // edge with their velocity reflected, bouncers losing half of it
+    void clampToArena(float halfExtent)
+    {
+        for(unsigned int e = 0; e < kind.size(); e++){
+            if(kind[e] == Bullet){
+                float3 p = position[e];
+                if(p.x > halfExtent || p.x < -halfExtent || p.z > halfExtent || p.z < -halfExtent)
+                    flags[e] |= Dead;
+                continue;
+            }
+            if(kind[e] != Seeker && kind[e] != Bouncer)
+                continue;
+            float bounce = kind[e] == Bouncer ? -.5 : -1;
+            if(position[e].x > halfExtent){
+                position[e].x = halfExtent;
+                velocity[e].x *= bounce;
+            }
+            if(position[e].x < -halfExtent){
+                position[e].x = -halfExtent;
+                velocity[e].x *= bounce;
+            }
+            if(position[e].z > halfExtent){
+                position[e].z = halfExtent;
+                velocity[e].z *= bounce;
+            }
+            if(position[e].z < -halfExtent){
+                position[e].z = -halfExtent;
+                velocity[e].z *= bounce;
+            }
+        }
+    }
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <math.h>
+#include "float3.h"
+
+// The six planes of a gluPerspective + gluLookAt view, facing inwards, for
+// throwing away what cannot be on screen before it is submitted. Only
+// bounding spheres are tested: a sphere is outside when it lies entirely
+// behind one of the planes. Spheres near a corner of the frustum can pass
+// every plane and still be off screen, which only costs a wasted draw.
+class Frustum
+{
+    float3 normals[6];
+    float distances[6];     // a point p is inside plane i when normals[i].dot(p) + distances[i] >= 0
+
+    void setPlane(int i, float3 normal, float3 point)
+    {
+        normals[i] = normal;
+        distances[i] = -normal.dot(point);
+    }
+
+public:
+    // fovY in radians; worldUp as given to gluLookAt
+    void set(float3 eye, float3 lookAt, float3 worldUp, float fovY, float aspect, float zNear, float zFar)
+    {
+        float3 forward = (lookAt - eye).normalize();
+        float3 side = forward.cross(worldUp).normalize();
+        float3 up = side.cross(forward);
+        float halfHeight = tanf(fovY * 0.5f);
+        float halfWidth = halfHeight * aspect;
+
+        setPlane(0, forward, eye + forward * zNear);
+        setPlane(1, -forward, eye + forward * zFar);
+        // each side plane goes through the eye, tilted in from the view axis by the half angle
+        setPlane(2, (side + forward * halfWidth).normalize(), eye);      // left
+        setPlane(3, (-side + forward * halfWidth).normalize(), eye);     // right
+        setPlane(4, (up + forward * halfHeight).normalize(), eye);       // bottom
+        setPlane(5, (-up + forward * halfHeight).normalize(), eye);      // top
+    }
+
+    bool intersectsSphere(float3 center, float radius) const
+    {
+        for(int i = 0; i < 6; i++)
+            if(normals[i].dot(center) + distances[i] < -radius)
+                return false;
+        return true;
+    }
+};
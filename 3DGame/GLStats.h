@@ -0,0 +1,42 @@
+#pragma once
+
+// Counts of what the game hands to GL, per frame. Including this after the
+// GL headers turns the counted calls below into macros that bump glStats()
+// and then make the call, so every call site in that file is counted without
+// being touched. Draws inside GLUT's own shapes (glutSolidTeapot,
+// glutSolidSphere, glutSolidCube) happen in the GLUT library and are not seen.
+struct GLStats
+{
+    unsigned long drawCalls;        // glDraw*, glBegin, glCallList
+    unsigned long vertices;         // by draw count, times instances; display lists add none
+    unsigned long capabilityChanges;// glEnable, glDisable
+    unsigned long materialChanges;  // glMaterial*
+    unsigned long textureBinds;
+
+    GLStats(){ reset(); }
+    void reset(){ drawCalls = vertices = capabilityChanges = materialChanges = textureBinds = 0; }
+    unsigned long stateChanges() const { return capabilityChanges + materialChanges + textureBinds; }
+};
+
+inline GLStats& glStats()
+{
+    static GLStats stats;
+    return stats;
+}
+
+#define glDrawArrays(mode, first, count) \
+    (glStats().drawCalls++, glStats().vertices += (count), glDrawArrays(mode, first, count))
+#define glDrawElements(mode, count, type, indices) \
+    (glStats().drawCalls++, glStats().vertices += (count), glDrawElements(mode, count, type, indices))
+#define glDrawElementsInstancedARB(mode, count, type, indices, instances) \
+    (glStats().drawCalls++, glStats().vertices += (unsigned long)(count) * (instances), \
+     glDrawElementsInstancedARB(mode, count, type, indices, instances))
+#define glBegin(mode)               (glStats().drawCalls++, glBegin(mode))
+#define glCallList(list)            (glStats().drawCalls++, glCallList(list))
+#define glVertex3f(x, y, z)         (glStats().vertices++, glVertex3f(x, y, z))
+#define glVertex4f(x, y, z, w)      (glStats().vertices++, glVertex4f(x, y, z, w))
+#define glEnable(cap)               (glStats().capabilityChanges++, glEnable(cap))
+#define glDisable(cap)              (glStats().capabilityChanges++, glDisable(cap))
+#define glMaterialf(face, name, v)  (glStats().materialChanges++, glMaterialf(face, name, v))
+#define glMaterialfv(face, name, v) (glStats().materialChanges++, glMaterialfv(face, name, v))
+#define glBindTexture(target, name) (glStats().textureBinds++, glBindTexture(target, name))
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string.h>
+#ifdef HEADLESS
+#include "HeadlessGL.h"
+#else
+#include <OpenGL/gl.h>
+#endif
+
+// GPU time of each render pass, from GL_EXT_timer_query (or the ARB
+// version, same enums). A pass brackets its GL calls with begin()/end();
+// passes cannot nest, GL runs one elapsed-time query at a time. Each frame
+// uses its own set of queries and reads them back framesInFlight frames
+// later, by which time the GPU is done with them, so reading never stalls
+// the CPU. A result that is still not there is dropped and the previous one
+// kept.
+class GpuTimer
+{
+public:
+    static const unsigned int maxPasses = 8;
+    static const unsigned int framesInFlight = 4;
+
+private:
+    GLuint queries[framesInFlight][maxPasses];
+    bool issued[framesInFlight][maxPasses];
+    const char* names[maxPasses];   // string literals, compared by pointer
+    double lastMs[maxPasses];
+    unsigned int passCount;
+    unsigned int frame;
+    int current;
+    bool initialized;
+    bool available;
+
+    void initialize()
+    {
+        initialized = true;
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        if(!extensions || (!strstr(extensions, "GL_EXT_timer_query") && !strstr(extensions, "GL_ARB_timer_query")))
+            return;
+        glGenQueries(framesInFlight * maxPasses, &queries[0][0]);
+        available = true;
+    }
+
+    int pass(const char* name)
+    {
+        for(unsigned int i = 0; i < passCount; i++)
+            if(names[i] == name)
+                return i;
+        if(passCount == maxPasses)
+            return -1;
+        names[passCount] = name;
+        lastMs[passCount] = 0;
+        return passCount++;
+    }
+
+public:
+    GpuTimer():passCount(0),frame(0),current(-1),initialized(false),available(false)
+    {
+        memset(issued, 0, sizeof(issued));
+    }
+
+    // needs the GL context
+    bool isAvailable()
+    {
+        if(!initialized)
+            initialize();
+        return available;
+    }
+
+    void begin(const char* name)
+    {
+        if(current >= 0 || !isAvailable())
+            return;
+        current = pass(name);
+        if(current >= 0)
+            glBeginQuery(GL_TIME_ELAPSED_EXT, queries[frame % framesInFlight][current]);
+    }
+
+    void end()
+    {
+        if(current < 0)
+            return;
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+        issued[frame % framesInFlight][current] = true;
+        current = -1;
+    }
+
+    // after the frame's last pass; picks up the results of the frame whose
+    // queries the next one reuses
+    void endFrame()
+    {
+        if(!available)
+            return;
+        frame++;
+        unsigned int slot = frame % framesInFlight;
+        for(unsigned int i = 0; i < passCount; i++){
+            if(!issued[slot][i])
+                continue;
+            issued[slot][i] = false;
+            GLint ready = 0;
+            glGetQueryObjectiv(queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &ready);
+            if(!ready)
+                continue;
+            GLuint64EXT nanoseconds = 0;
+            glGetQueryObjectui64vEXT(queries[slot][i], GL_QUERY_RESULT, &nanoseconds);
+            lastMs[i] = nanoseconds * 1e-6;
+        }
+    }
+
+    unsigned int getPassCount() const { return passCount; }
+    const char* getPassName(unsigned int i) const { return names[i]; }
+    // as of framesInFlight frames ago
+    double getPassMs(unsigned int i) const { return lastMs[i]; }
+};
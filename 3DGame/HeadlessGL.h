@@ -0,0 +1,277 @@
+#pragma once
+
+// Stand-ins for the GL, GLU and GLUT calls the game makes, for the HEADLESS
+// build: the simulation compiles unchanged and links without a GL library.
+// Every call does nothing; queries return 0, so generated names are 0 and
+// the instanced path reports itself unsupported. Nothing is drawn in this
+// build, the stubs only have to type-check.
+
+#include <stddef.h>
+
+typedef unsigned int GLenum;
+typedef unsigned char GLboolean;
+typedef unsigned int GLbitfield;
+typedef void GLvoid;
+typedef int GLint;
+typedef unsigned int GLuint;
+typedef int GLsizei;
+typedef float GLfloat;
+typedef double GLdouble;
+typedef char GLchar;
+typedef unsigned char GLubyte;
+typedef unsigned long long GLuint64EXT;
+
+#define GL_FALSE                    0
+#define GL_NONE                     0
+#define GL_TRUE                     1
+#define GL_TRIANGLES                0x0004
+#define GL_TRIANGLE_STRIP           0x0005
+#define GL_QUADS                    0x0007
+#define GL_LEQUAL                   0x0203
+#define GL_GREATER                  0x0204
+#define GL_SRC_ALPHA                0x0302
+#define GL_ONE_MINUS_SRC_ALPHA      0x0303
+#define GL_FRONT_AND_BACK           0x0408
+#define GL_LIGHTING                 0x0B50
+#define GL_DEPTH_TEST               0x0B71
+#define GL_NORMALIZE                0x0BA1
+#define GL_VIEWPORT                 0x0BA2
+#define GL_MODELVIEW_MATRIX         0x0BA6
+#define GL_PROJECTION_MATRIX        0x0BA7
+#define GL_ALPHA_TEST               0x0BC0
+#define GL_BLEND                    0x0BE2
+#define GL_SCISSOR_TEST             0x0C11
+#define GL_COLOR_CLEAR_VALUE        0x0C22
+#define GL_TEXTURE_GEN_S            0x0C60
+#define GL_TEXTURE_GEN_T            0x0C61
+#define GL_TEXTURE_GEN_R            0x0C62
+#define GL_TEXTURE_GEN_Q            0x0C63
+#define GL_TEXTURE_2D               0x0DE1
+#define GL_MAX_LIGHTS               0x0D31
+#define GL_TEXTURE_BORDER_COLOR     0x1004
+#define GL_UNSIGNED_BYTE            0x1401
+#define GL_UNSIGNED_SHORT           0x1403
+#define GL_UNSIGNED_INT             0x1405
+#define GL_FLOAT                    0x1406
+#define GL_AMBIENT                  0x1200
+#define GL_DIFFUSE                  0x1201
+#define GL_SPECULAR                 0x1202
+#define GL_POSITION                 0x1203
+#define GL_CONSTANT_ATTENUATION     0x1207
+#define GL_LINEAR_ATTENUATION       0x1208
+#define GL_QUADRATIC_ATTENUATION    0x1209
+#define GL_COMPILE                  0x1300
+#define GL_SHININESS                0x1601
+#define GL_MODELVIEW                0x1700
+#define GL_PROJECTION               0x1701
+#define GL_TEXTURE                  0x1702
+#define GL_DEPTH_COMPONENT          0x1902
+#define GL_RGB                      0x1907
+#define GL_RGBA                     0x1908
+#define GL_EXTENSIONS               0x1F03
+#define GL_REPLACE                  0x1E01
+#define GL_S                        0x2000
+#define GL_T                        0x2001
+#define GL_R                        0x2002
+#define GL_Q                        0x2003
+#define GL_MODULATE                 0x2100
+#define GL_TEXTURE_ENV_MODE         0x2200
+#define GL_TEXTURE_ENV_COLOR        0x2201
+#define GL_TEXTURE_ENV              0x2300
+#define GL_EYE_LINEAR               0x2400
+#define GL_TEXTURE_GEN_MODE         0x2500
+#define GL_EYE_PLANE                0x2502
+#define GL_LINEAR                   0x2601
+#define GL_LINEAR_MIPMAP_LINEAR     0x2703
+#define GL_TEXTURE_MAG_FILTER       0x2800
+#define GL_TEXTURE_MIN_FILTER       0x2801
+#define GL_TEXTURE_WRAP_S           0x2802
+#define GL_TEXTURE_WRAP_T           0x2803
+#define GL_LIGHT0                   0x4000
+#define GL_POLYGON_OFFSET_FILL      0x8037
+#define GL_INTENSITY                0x8049
+#define GL_VERTEX_ARRAY             0x8074
+#define GL_NORMAL_ARRAY             0x8075
+#define GL_COLOR_ARRAY              0x8076
+#define GL_TEXTURE_COORD_ARRAY      0x8078
+#define GL_CLAMP_TO_BORDER          0x812D
+#define GL_CLAMP_TO_EDGE            0x812F
+#define GL_DEPTH_COMPONENT24        0x81A6
+#define GL_TEXTURE0                 0x84C0
+#define GL_TEXTURE1                 0x84C1
+#define GL_COMBINE                  0x8570
+#define GL_COMBINE_RGB              0x8571
+#define GL_INTERPOLATE              0x8575
+#define GL_CONSTANT                 0x8576
+#define GL_PREVIOUS                 0x8578
+#define GL_SOURCE0_RGB              0x8580
+#define GL_SOURCE1_RGB              0x8581
+#define GL_SOURCE2_RGB              0x8582
+#define GL_DEPTH_TEXTURE_MODE_ARB   0x884B
+#define GL_TEXTURE_COMPARE_MODE_ARB 0x884C
+#define GL_TEXTURE_COMPARE_FUNC_ARB 0x884D
+#define GL_COMPARE_R_TO_TEXTURE_ARB 0x884E
+#define GL_QUERY_RESULT             0x8866
+#define GL_QUERY_RESULT_AVAILABLE   0x8867
+#define GL_ARRAY_BUFFER             0x8892
+#define GL_ELEMENT_ARRAY_BUFFER     0x8893
+#define GL_TIME_ELAPSED_EXT         0x88BF
+#define GL_STREAM_DRAW              0x88E0
+#define GL_STATIC_DRAW              0x88E4
+#define GL_FRAGMENT_SHADER          0x8B30
+#define GL_VERTEX_SHADER            0x8B31
+#define GL_COMPILE_STATUS           0x8B81
+#define GL_LINK_STATUS              0x8B82
+#define GL_FRAMEBUFFER_COMPLETE_EXT 0x8CD5
+#define GL_COLOR_ATTACHMENT0_EXT    0x8CE0
+#define GL_DEPTH_ATTACHMENT_EXT     0x8D00
+#define GL_FRAMEBUFFER_EXT          0x8D40
+#define GL_RENDERBUFFER_EXT         0x8D41
+#define GL_COLOR_BUFFER_BIT         0x00004000
+#define GL_DEPTH_BUFFER_BIT         0x00000100
+
+#define GLUT_RGBA                   0
+#define GLUT_DOUBLE                 2
+#define GLUT_DEPTH                  16
+#define GLUT_LEFT_BUTTON            0
+#define GLUT_DOWN                   0
+#define GLUT_ELAPSED_TIME           700
+#define GLUT_BITMAP_8_BY_13         ((void*)3)
+#define GLUT_BITMAP_TIMES_ROMAN_24  ((void*)5)
+
+// calls without a result, whatever their arguments
+#define HEADLESS_GL_NOOP(name) template <class... Args> inline void name(Args...) {}
+
+HEADLESS_GL_NOOP(glActiveTexture)
+HEADLESS_GL_NOOP(glAlphaFunc)
+HEADLESS_GL_NOOP(glAttachShader)
+HEADLESS_GL_NOOP(glBegin)
+HEADLESS_GL_NOOP(glBeginQuery)
+HEADLESS_GL_NOOP(glBindAttribLocation)
+HEADLESS_GL_NOOP(glBindBuffer)
+HEADLESS_GL_NOOP(glBindFramebufferEXT)
+HEADLESS_GL_NOOP(glBindRenderbufferEXT)
+HEADLESS_GL_NOOP(glBindTexture)
+HEADLESS_GL_NOOP(glBlendFunc)
+HEADLESS_GL_NOOP(glBufferData)
+HEADLESS_GL_NOOP(glCallList)
+HEADLESS_GL_NOOP(glClear)
+HEADLESS_GL_NOOP(glClearColor)
+HEADLESS_GL_NOOP(glColor3f)
+HEADLESS_GL_NOOP(glColor4d)
+HEADLESS_GL_NOOP(glColorMask)
+HEADLESS_GL_NOOP(glColorPointer)
+HEADLESS_GL_NOOP(glCompileShader)
+HEADLESS_GL_NOOP(glDeleteBuffers)
+HEADLESS_GL_NOOP(glDeleteFramebuffersEXT)
+HEADLESS_GL_NOOP(glDeleteLists)
+HEADLESS_GL_NOOP(glDeleteProgram)
+HEADLESS_GL_NOOP(glDeleteRenderbuffersEXT)
+HEADLESS_GL_NOOP(glDeleteShader)
+HEADLESS_GL_NOOP(glDeleteTextures)
+HEADLESS_GL_NOOP(glDepthMask)
+HEADLESS_GL_NOOP(glDisable)
+HEADLESS_GL_NOOP(glDisableClientState)
+HEADLESS_GL_NOOP(glDisableVertexAttribArray)
+HEADLESS_GL_NOOP(glDrawArrays)
+HEADLESS_GL_NOOP(glDrawBuffer)
+HEADLESS_GL_NOOP(glDrawElements)
+HEADLESS_GL_NOOP(glDrawElementsInstancedARB)
+HEADLESS_GL_NOOP(glEnable)
+HEADLESS_GL_NOOP(glEnableClientState)
+HEADLESS_GL_NOOP(glEnableVertexAttribArray)
+HEADLESS_GL_NOOP(glEnd)
+HEADLESS_GL_NOOP(glEndList)
+HEADLESS_GL_NOOP(glEndQuery)
+HEADLESS_GL_NOOP(glFinish)
+HEADLESS_GL_NOOP(glFramebufferRenderbufferEXT)
+HEADLESS_GL_NOOP(glFramebufferTexture2DEXT)
+HEADLESS_GL_NOOP(glGenerateMipmapEXT)
+HEADLESS_GL_NOOP(glGetFloatv)
+HEADLESS_GL_NOOP(glGetIntegerv)
+HEADLESS_GL_NOOP(glGetProgramInfoLog)
+HEADLESS_GL_NOOP(glGetProgramiv)
+HEADLESS_GL_NOOP(glGetQueryObjectiv)
+HEADLESS_GL_NOOP(glGetQueryObjectui64vEXT)
+HEADLESS_GL_NOOP(glGetShaderInfoLog)
+HEADLESS_GL_NOOP(glGetShaderiv)
+HEADLESS_GL_NOOP(glGetTexEnviv)
+HEADLESS_GL_NOOP(glLightf)
+HEADLESS_GL_NOOP(glLightfv)
+HEADLESS_GL_NOOP(glLinkProgram)
+HEADLESS_GL_NOOP(glLoadIdentity)
+HEADLESS_GL_NOOP(glMaterialf)
+HEADLESS_GL_NOOP(glMaterialfv)
+HEADLESS_GL_NOOP(glMatrixMode)
+HEADLESS_GL_NOOP(glMultMatrixf)
+HEADLESS_GL_NOOP(glNewList)
+HEADLESS_GL_NOOP(glNormal3f)
+HEADLESS_GL_NOOP(glNormalPointer)
+HEADLESS_GL_NOOP(glOrtho)
+HEADLESS_GL_NOOP(glPolygonOffset)
+HEADLESS_GL_NOOP(glPopMatrix)
+HEADLESS_GL_NOOP(glPushMatrix)
+HEADLESS_GL_NOOP(glRasterPos3f)
+HEADLESS_GL_NOOP(glReadBuffer)
+HEADLESS_GL_NOOP(glRenderbufferStorageEXT)
+HEADLESS_GL_NOOP(glRotatef)
+HEADLESS_GL_NOOP(glScalef)
+HEADLESS_GL_NOOP(glScissor)
+HEADLESS_GL_NOOP(glShaderSource)
+HEADLESS_GL_NOOP(glTexCoord2f)
+HEADLESS_GL_NOOP(glTexCoord3d)
+HEADLESS_GL_NOOP(glTexCoordPointer)
+HEADLESS_GL_NOOP(glTexEnvfv)
+HEADLESS_GL_NOOP(glTexEnvi)
+HEADLESS_GL_NOOP(glTexGenfv)
+HEADLESS_GL_NOOP(glTexGeni)
+HEADLESS_GL_NOOP(glTexImage2D)
+HEADLESS_GL_NOOP(glTexParameterfv)
+HEADLESS_GL_NOOP(glTexParameteri)
+HEADLESS_GL_NOOP(glTranslatef)
+HEADLESS_GL_NOOP(glUniform1i)
+HEADLESS_GL_NOOP(glUseProgram)
+HEADLESS_GL_NOOP(glVertex3f)
+HEADLESS_GL_NOOP(glVertex4f)
+HEADLESS_GL_NOOP(glVertexAttribDivisorARB)
+HEADLESS_GL_NOOP(glVertexAttribPointer)
+HEADLESS_GL_NOOP(glVertexPointer)
+HEADLESS_GL_NOOP(glViewport)
+HEADLESS_GL_NOOP(gluBuild2DMipmaps)
+HEADLESS_GL_NOOP(gluLookAt)
+HEADLESS_GL_NOOP(gluOrtho2D)
+HEADLESS_GL_NOOP(gluPerspective)
+HEADLESS_GL_NOOP(glutBitmapCharacter)
+HEADLESS_GL_NOOP(glutDisplayFunc)
+HEADLESS_GL_NOOP(glutIdleFunc)
+HEADLESS_GL_NOOP(glutInit)
+HEADLESS_GL_NOOP(glutInitDisplayMode)
+HEADLESS_GL_NOOP(glutInitWindowPosition)
+HEADLESS_GL_NOOP(glutInitWindowSize)
+HEADLESS_GL_NOOP(glutKeyboardFunc)
+HEADLESS_GL_NOOP(glutKeyboardUpFunc)
+HEADLESS_GL_NOOP(glutMainLoop)
+HEADLESS_GL_NOOP(glutMotionFunc)
+HEADLESS_GL_NOOP(glutMouseFunc)
+HEADLESS_GL_NOOP(glutPostRedisplay)
+HEADLESS_GL_NOOP(glutReshapeFunc)
+HEADLESS_GL_NOOP(glutSolidCube)
+HEADLESS_GL_NOOP(glutSolidSphere)
+HEADLESS_GL_NOOP(glutSolidTeapot)
+HEADLESS_GL_NOOP(glutSwapBuffers)
+
+// name generation hands out 0, "no object"
+inline void glGenBuffers(GLsizei n, GLuint* names){ for(GLsizei i = 0; i < n; i++) names[i] = 0; }
+inline void glGenFramebuffersEXT(GLsizei n, GLuint* names){ for(GLsizei i = 0; i < n; i++) names[i] = 0; }
+inline void glGenQueries(GLsizei n, GLuint* names){ for(GLsizei i = 0; i < n; i++) names[i] = 0; }
+inline void glGenRenderbuffersEXT(GLsizei n, GLuint* names){ for(GLsizei i = 0; i < n; i++) names[i] = 0; }
+inline void glGenTextures(GLsizei n, GLuint* names){ for(GLsizei i = 0; i < n; i++) names[i] = 0; }
+inline GLuint glGenLists(GLsizei){ return 0; }
+inline GLuint glCreateShader(GLenum){ return 0; }
+inline GLuint glCreateProgram(){ return 0; }
+inline GLint glGetUniformLocation(GLuint, const GLchar*){ return -1; }
+inline const GLubyte* glGetString(GLenum){ return NULL; }
+inline GLboolean glIsEnabled(GLenum){ return GL_FALSE; }
+inline GLenum glCheckFramebufferStatusEXT(GLenum){ return 0; }
+inline int glutGet(GLenum){ return 0; }
+inline int glutCreateWindow(const char*){ return 0; }
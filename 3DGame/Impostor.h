@@ -0,0 +1,240 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#ifdef HEADLESS
+#include "HeadlessGL.h"
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glu.h>
+#endif
+#include "float3.h"
+
+// Pictures of a model from views around its vertical axis, for drawing it
+// far away as one camera-facing quad. begin()/beginView()/end() bracket
+// rendering the model into each tile of an RGBA atlas through an EXT
+// framebuffer, once, with the model's own material and whatever lights are
+// set: the tiles are orthographic views of the bounding sphere from the
+// side, cleared to transparent. add() then queues a quad showing the view
+// nearest to the camera's direction, and draw() sends the frame's quads in
+// one call, each faded by its own alpha. Quads are pulled to the front of
+// the bound and shrunk to match, so the model drawn through the cross-fade
+// is covered by its impostor instead of poking through it.
+class ImpostorAtlas
+{
+public:
+    static const unsigned int views = 16;
+    static const unsigned int columns = 4;
+    static const int tileSize = 128;
+
+private:
+    struct Vertex
+    {
+        float position[3];
+        float texcoord[2];
+        float color[4];
+    };
+    float3 center;          // model-space bound the tiles frame
+    float radius;
+    GLuint texture;
+    GLuint framebuffer;
+    GLuint depthBuffer;
+    GLint savedViewport[4];
+    GLfloat savedClearColor[4];
+    bool built;
+    std::vector<Vertex> vertices;
+
+    static bool isSupported()
+    {
+        static int supported = -1;
+        if(supported < 0){
+            const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+            supported = extensions && strstr(extensions, "GL_EXT_framebuffer_object") ? 1 : 0;
+        }
+        return supported == 1;
+    }
+
+    // a view looks at the model from (sin, 0, cos) of its angle, in model space
+    static float viewAngle(unsigned int view)
+    {
+        return 2 * M_PI * view / views;
+    }
+
+    void pushVertex(float3 p, float s, float t, float alpha)
+    {
+        Vertex v = { { p.x, p.y, p.z }, { s, t }, { 1, 1, 1, alpha } };
+        vertices.push_back(v);
+    }
+
+public:
+    ImpostorAtlas(float3 center, float radius):center(center),radius(radius),texture(0),framebuffer(0),depthBuffer(0),built(false){}
+
+    ~ImpostorAtlas()
+    {
+        if(depthBuffer)
+            glDeleteRenderbuffersEXT(1, &depthBuffer);
+        if(framebuffer)
+            glDeleteFramebuffersEXT(1, &framebuffer);
+        if(texture)
+            glDeleteTextures(1, &texture);
+    }
+
+    bool isBuilt() const { return built; }
+
+    // needs the GL context; false if the atlas cannot be rendered, and then
+    // nothing is to be drawn for it
+    bool begin()
+    {
+        if(built || !isSupported())
+            return false;
+        int width = columns * tileSize, height = (views + columns - 1) / columns * tileSize;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenRenderbuffersEXT(1, &depthBuffer);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+
+        glGenFramebuffersEXT(1, &framebuffer);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, depthBuffer);
+        GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+        if(status != GL_FRAMEBUFFER_COMPLETE_EXT){
+            printf("impostor: framebuffer incomplete (0x%x), drawing meshes\n", status);
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+            glDeleteRenderbuffersEXT(1, &depthBuffer);
+            glDeleteFramebuffersEXT(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            depthBuffer = framebuffer = texture = 0;
+            return false;
+        }
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClearColor);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glClearColor(0, 0, 0, 0);
+        glEnable(GL_SCISSOR_TEST);
+        return true;
+    }
+
+    // the model drawn next, in model space, lands in this view's tile
+    void beginView(unsigned int view)
+    {
+        int x = view % columns * tileSize, y = view / columns * tileSize;
+        glViewport(x, y, tileSize, tileSize);
+        glScissor(x, y, tileSize, tileSize);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glOrtho(-radius, radius, -radius, radius, radius, 3 * radius);
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+        float angle = viewAngle(view);
+        float3 eye = center + float3(sinf(angle), 0, cosf(angle)) * (2 * radius);
+        gluLookAt(eye.x, eye.y, eye.z, center.x, center.y, center.z, 0, 1, 0);
+    }
+
+    void end()
+    {
+        glDisable(GL_SCISSOR_TEST);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glClearColor(savedClearColor[0], savedClearColor[1], savedClearColor[2], savedClearColor[3]);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGenerateMipmapEXT(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        // only the texture is needed from here on
+        glDeleteRenderbuffersEXT(1, &depthBuffer);
+        glDeleteFramebuffersEXT(1, &framebuffer);
+        depthBuffer = framebuffer = 0;
+        built = true;
+    }
+
+    // a model whose bound is at worldCenter with worldRadius, turned by
+    // orientation degrees about y; rotation is the camera's billboard matrix
+    // (right, up, ahead columns) and alpha its share of the cross-fade
+    void add(const float rotation[16], float3 eye, float3 worldCenter, float worldRadius, float orientation, float alpha)
+    {
+        float3 right(rotation[0], rotation[1], rotation[2]);
+        float3 up(rotation[4], rotation[5], rotation[6]);
+        float3 toEye = eye - worldCenter;
+        float distance = toEye.norm();
+        if(distance <= worldRadius)
+            return;
+        toEye = toEye * (1 / distance);
+        // the direction to the eye in model space picks the view
+        float a = orientation * M_PI / 180;
+        float x = toEye.x * cosf(a) - toEye.z * sinf(a);
+        float z = toEye.x * sinf(a) + toEye.z * cosf(a);
+        float angle = atan2f(x, z);
+        if(angle < 0)
+            angle += 2 * M_PI;
+        unsigned int view = (unsigned int)floorf(angle / (2 * M_PI) * views + 0.5f) % views;
+
+        float3 position = worldCenter + toEye * worldRadius;
+        float half = worldRadius * (distance - worldRadius) / distance;
+        float3 across = right * half, along = up * half;
+        int rows = (views + columns - 1) / columns;
+        float s0 = (float)(view % columns) / columns, s1 = s0 + 1.0f / columns;
+        float t0 = (float)(view / columns) / rows, t1 = t0 + 1.0f / rows;
+        pushVertex(position - across - along, s0, t0, alpha);
+        pushVertex(position + across - along, s1, t0, alpha);
+        pushVertex(position + across + along, s1, t1, alpha);
+        pushVertex(position - across + along, s0, t1, alpha);
+    }
+
+    // this frame's quads, unlit and alpha blended; returns how many were drawn
+    unsigned int draw()
+    {
+        unsigned int quads = vertices.size() / 4;
+        if(quads == 0)
+            return 0;
+        GLint savedEnvMode = GL_MODULATE;
+        glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &savedEnvMode);
+        glDisable(GL_LIGHTING);
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        // the empty parts of a tile leave the depth buffer alone
+        glEnable(GL_ALPHA_TEST);
+        glAlphaFunc(GL_GREATER, 0.05f);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(Vertex), &vertices[0].position);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].texcoord);
+        glColorPointer(4, GL_FLOAT, sizeof(Vertex), &vertices[0].color);
+        glDrawArrays(GL_QUADS, 0, vertices.size());
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        glDisable(GL_ALPHA_TEST);
+        glDisable(GL_BLEND);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, savedEnvMode);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glEnable(GL_LIGHTING);
+        glColor4d(1, 1, 1, 1);
+        vertices.clear();
+        return quads;
+    }
+};
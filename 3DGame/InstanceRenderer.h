@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifdef HEADLESS
+#include "HeadlessGL.h"
+#else
+#include <OpenGL/gl.h>
+#endif
+#include "meshpack/Mesh.h"
+
+// Draws many copies of one mesh with a single call per submesh. The model
+// matrices go into a stream buffer read as a per-instance mat4 attribute
+// (ARB_instanced_arrays), and a GLSL 1.20 shader stands in for the fixed
+// function pipeline: it lights with the enabled GL lights and current
+// material when GL_LIGHTING is on, otherwise takes glColor, and replaces the
+// colour with the bound texture when GL_TEXTURE_2D is on, the way
+// TexturedMaterial sets up the texture environment. Everything else
+// (modelview, material, texture) is whatever the caller has set.
+class InstanceRenderer
+{
+    GLuint program;
+    GLuint instanceBuffer;
+    GLint litLocation;
+    GLint texturedLocation;
+    GLint lightCountLocation;
+    bool initialized;
+    bool available;
+
+    static const GLuint matrixAttribute = 4;    // a mat4 takes four consecutive slots
+
+    static GLuint compile(GLenum type, const char* source)
+    {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        GLint ok = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if(!ok){
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+            printf("instancing shader: %s\n", log);
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+
+    void initialize()
+    {
+        initialized = true;
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        if(!extensions || !strstr(extensions, "GL_ARB_instanced_arrays") || !strstr(extensions, "GL_ARB_draw_instanced")){
+            printf("instancing: not supported, drawing objects one by one\n");
+            return;
+        }
+        const char* vertexSource =
+            "#version 120\n"
+            "attribute mat4 instanceMatrix;\n"
+            "uniform bool lit;\n"
+            "uniform int lightCount;\n"
+            "varying vec4 color;\n"
+            "void main(){\n"
+            "    vec4 eye = gl_ModelViewMatrix * (instanceMatrix * gl_Vertex);\n"
+            "    gl_Position = gl_ProjectionMatrix * eye;\n"
+            "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+            "    if(!lit){\n"
+            "        color = gl_Color;\n"
+            "        return;\n"
+            "    }\n"
+            // rotate * scale, so the inverse transpose is the matrix over the squared column lengths
+            "    mat3 m = mat3(instanceMatrix);\n"
+            "    vec3 n = m * (gl_Normal / vec3(dot(m[0], m[0]), dot(m[1], m[1]), dot(m[2], m[2])));\n"
+            "    n = normalize(gl_NormalMatrix * n);\n"
+            "    vec4 c = gl_FrontLightModelProduct.sceneColor;\n"
+            "    for(int i = 0; i < 8; i++){\n"
+            "        if(i >= lightCount)\n"
+            "            break;\n"
+            "        vec3 l = gl_LightSource[i].position.xyz;\n"
+            "        float attenuation = 1.0;\n"
+            "        if(gl_LightSource[i].position.w != 0.0){\n"
+            "            l -= eye.xyz;\n"
+            "            float d = length(l);\n"
+            "            attenuation = 1.0 / (gl_LightSource[i].constantAttenuation\n"
+            "                + gl_LightSource[i].linearAttenuation * d + gl_LightSource[i].quadraticAttenuation * d * d);\n"
+            "        }\n"
+            "        l = normalize(l);\n"
+            "        float nl = max(dot(n, l), 0.0);\n"
+            "        c += attenuation * gl_FrontLightProduct[i].ambient;\n"
+            "        if(nl > 0.0){\n"
+            "            float nh = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);\n"
+            "            c += attenuation * (nl * gl_FrontLightProduct[i].diffuse\n"
+            "                + pow(nh, gl_FrontMaterial.shininess) * gl_FrontLightProduct[i].specular);\n"
+            "        }\n"
+            "    }\n"
+            "    color = clamp(c, 0.0, 1.0);\n"
+            "}\n";
+        const char* fragmentSource =
+            "#version 120\n"
+            "uniform bool textured;\n"
+            "uniform sampler2D skin;\n"
+            "varying vec4 color;\n"
+            "void main(){\n"
+            "    gl_FragColor = textured ? texture2D(skin, gl_TexCoord[0].st) : color;\n"
+            "}\n";
+        GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexSource);
+        GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentSource);
+        if(!vertexShader || !fragmentShader)
+            return;
+        program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glBindAttribLocation(program, matrixAttribute, "instanceMatrix");
+        glLinkProgram(program);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        GLint ok = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if(!ok){
+            char log[1024];
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            printf("instancing shader: %s\n", log);
+            glDeleteProgram(program);
+            program = 0;
+            return;
+        }
+        litLocation = glGetUniformLocation(program, "lit");
+        texturedLocation = glGetUniformLocation(program, "textured");
+        lightCountLocation = glGetUniformLocation(program, "lightCount");
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "skin"), 0);
+        glUseProgram(0);
+        glGenBuffers(1, &instanceBuffer);
+        available = true;
+    }
+
+public:
+    InstanceRenderer():program(0),instanceBuffer(0),litLocation(-1),texturedLocation(-1),lightCountLocation(-1),
+        initialized(false),available(false){}
+
+    // needs the GL context; false means callers draw their objects individually
+    bool isAvailable()
+    {
+        if(!initialized)
+            initialize();
+        return available;
+    }
+
+    // one column-major 4x4 matrix (16 floats) per instance, all at the given
+    // level of detail; false if the mesh cannot be drawn this way yet,
+    // nothing is drawn then
+    bool draw(Mesh* mesh, const std::vector<float>& matrices, unsigned int lod = 0)
+    {
+        unsigned int instanceCount = matrices.size() / 16;
+        if(!isAvailable() || instanceCount == 0)
+            return false;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(float), matrices.data(), GL_STREAM_DRAW);
+        for(GLuint column = 0; column < 4; column++){
+            glEnableVertexAttribArray(matrixAttribute + column);
+            glVertexAttribPointer(matrixAttribute + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float),
+                                  (const GLvoid*)(column * 4 * sizeof(float)));
+            glVertexAttribDivisorARB(matrixAttribute + column, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        int lightCount = 0;
+        while(lightCount < 8 && glIsEnabled(GL_LIGHT0 + lightCount))
+            lightCount++;
+        glUseProgram(program);
+        glUniform1i(litLocation, glIsEnabled(GL_LIGHTING));
+        glUniform1i(texturedLocation, glIsEnabled(GL_TEXTURE_2D));
+        glUniform1i(lightCountLocation, lightCount);
+        bool drawn = mesh->drawInstanced(instanceCount, lod);
+        glUseProgram(0);
+
+        for(GLuint column = 0; column < 4; column++){
+            glVertexAttribDivisorARB(matrixAttribute + column, 0);
+            glDisableVertexAttribArray(matrixAttribute + column);
+        }
+        return drawn;
+    }
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// Free-list allocator for one class of objects that are spawned and killed
+// all through a game, backing that class's operator new and delete. Slots
+// come from chunks of slotsPerChunk, which are only allocated when the free
+// list runs dry and are kept until the pool goes away, so once a game has
+// reached its peak population spawning and despawning never reach the
+// global allocator. reset() hands every slot back at once without running
+// destructors, for when a whole game session is thrown away.
+template <class T>
+class ObjectPool
+{
+    struct FreeSlot { FreeSlot* next; };
+
+    unsigned int slotsPerChunk;
+    std::vector<char*> chunks;
+    FreeSlot* freeList;
+    unsigned int live;
+    unsigned int highWater;
+    unsigned long allocations;
+
+    // rounded up so every slot stays aligned like the chunk itself
+    static size_t slotSize()
+    {
+        const size_t alignment = 16;
+        size_t size = sizeof(T) > sizeof(FreeSlot) ? sizeof(T) : sizeof(FreeSlot);
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    void thread(char* chunk)
+    {
+        for(unsigned int i = slotsPerChunk; i > 0; i--){
+            FreeSlot* slot = (FreeSlot*)(chunk + (i - 1) * slotSize());
+            slot->next = freeList;
+            freeList = slot;
+        }
+    }
+
+public:
+    ObjectPool(unsigned int slotsPerChunk = 256):slotsPerChunk(slotsPerChunk),freeList(NULL),live(0),highWater(0),allocations(0){}
+
+    ~ObjectPool()
+    {
+        for(unsigned int i = 0; i < chunks.size(); i++)
+            delete[] chunks[i];
+    }
+
+    void* allocate()
+    {
+        if(!freeList){
+            chunks.push_back(new char[slotsPerChunk * slotSize()]);
+            thread(chunks.back());
+        }
+        FreeSlot* slot = freeList;
+        freeList = slot->next;
+        allocations++;
+        if(++live > highWater)
+            highWater = live;
+        return slot;
+    }
+
+    void release(void* p)
+    {
+        if(!p)
+            return;
+        FreeSlot* slot = (FreeSlot*)p;
+        slot->next = freeList;
+        freeList = slot;
+        live--;
+    }
+
+    // every slot is free again; objects still in them are abandoned, not destroyed
+    void reset()
+    {
+        freeList = NULL;
+        for(unsigned int i = chunks.size(); i > 0; i--)
+            thread(chunks[i - 1]);
+        live = 0;
+    }
+
+    unsigned int getLive() const { return live; }
+    unsigned int getHighWater() const { return highWater; }
+    unsigned long getAllocations() const { return allocations; }
+    unsigned int getCapacity() const { return chunks.size() * slotsPerChunk; }
+    unsigned int getChunks() const { return chunks.size(); }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// CPU time per named zone of the frame. A ProfileZone on the stack times its
+// scope; zones nest, and each thread keeps its own nesting. endFrame() turns
+// what every zone spent this frame into one sample, and getStats() gives the
+// min, average and 99th percentile over the last historyFrames samples.
+// While tracing, every zone is also kept as an event, and writeTrace() saves
+// them as Chrome trace JSON for chrome://tracing or Perfetto.
+// Zone names must be string literals: they are compared and kept by pointer.
+class Profiler
+{
+public:
+    struct Stats
+    {
+        const char* name;
+        int depth;
+        double minMs;
+        double averageMs;
+        double p99Ms;
+    };
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Zone
+    {
+        const char* name;
+        int depth;              // when first seen, for indenting
+        double frameMs;
+        std::vector<float> history;
+    };
+    struct TraceEvent
+    {
+        const char* name;
+        unsigned int thread;
+        double startUs;
+        double durationUs;
+    };
+
+    std::mutex mutex;
+    std::vector<Zone> zones;    // in the order they first ran
+    unsigned int historyFrames;
+    unsigned int frames;
+    Clock::time_point origin;
+    bool tracing;
+    size_t maxTraceEvents;
+    std::vector<TraceEvent> trace;
+    std::map<std::thread::id, unsigned int> threads;
+
+    static int& threadDepth()
+    {
+        static thread_local int depth = 0;
+        return depth;
+    }
+
+    Zone& zone(const char* name, int depth)
+    {
+        for(unsigned int i = 0; i < zones.size(); i++)
+            if(zones[i].name == name)
+                return zones[i];
+        Zone z;
+        z.name = name;
+        z.depth = depth;
+        z.frameMs = 0;
+        z.history.assign(historyFrames, 0);
+        zones.push_back(z);
+        return zones.back();
+    }
+
+    friend class ProfileZone;
+
+    // the zone is listed from its first start, so parents come before their children
+    Clock::time_point begin(const char* name)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            zone(name, threadDepth());
+        }
+        threadDepth()++;
+        return Clock::now();
+    }
+
+    void end(const char* name, Clock::time_point start)
+    {
+        Clock::time_point now = Clock::now();
+        int depth = --threadDepth();
+        double ms = std::chrono::duration<double, std::milli>(now - start).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        zone(name, depth).frameMs += ms;
+        if(tracing && trace.size() < maxTraceEvents){
+            std::map<std::thread::id, unsigned int>::iterator t = threads.find(std::this_thread::get_id());
+            if(t == threads.end())
+                t = threads.insert(std::make_pair(std::this_thread::get_id(), (unsigned int)threads.size())).first;
+            TraceEvent e = { name, t->second,
+                std::chrono::duration<double, std::micro>(start - origin).count(), ms * 1000 };
+            trace.push_back(e);
+        }
+    }
+
+public:
+    Profiler(unsigned int historyFrames = 300):historyFrames(historyFrames),frames(0),origin(Clock::now()),
+        tracing(false),maxTraceEvents(4000000){}
+
+    void endFrame()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(unsigned int i = 0; i < zones.size(); i++){
+            zones[i].history[frames % historyFrames] = zones[i].frameMs;
+            zones[i].frameMs = 0;
+        }
+        frames++;
+    }
+
+    // one entry per zone, in the order they first ran
+    void getStats(std::vector<Stats>& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.clear();
+        unsigned int n = std::min(frames, historyFrames);
+        if(n == 0)
+            return;
+        std::vector<float> sorted;
+        for(unsigned int i = 0; i < zones.size(); i++){
+            sorted.assign(zones[i].history.begin(), zones[i].history.begin() + n);
+            std::sort(sorted.begin(), sorted.end());
+            double sum = 0;
+            for(unsigned int k = 0; k < n; k++)
+                sum += sorted[k];
+            Stats s = { zones[i].name, zones[i].depth, sorted[0], sum / n, sorted[(n - 1) * 99 / 100] };
+            out.push_back(s);
+        }
+    }
+
+    // keeps an event per zone from now on, up to a few million
+    void startTrace()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tracing = true;
+    }
+
+    bool isTracing() const { return tracing; }
+
+    bool writeTrace(const char* path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        FILE* f = fopen(path, "w");
+        if(!f)
+            return false;
+        fprintf(f, "{\"traceEvents\":[\n");
+        for(size_t i = 0; i < trace.size(); i++){
+            const TraceEvent& e = trace[i];
+            fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                    e.name, e.thread, e.startUs, e.durationUs, i + 1 < trace.size() ? "," : "");
+        }
+        fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(f);
+        printf("profiler: %lu events written to %s\n", (unsigned long)trace.size(), path);
+        return true;
+    }
+};
+
+// times the enclosing scope under name
+class ProfileZone
+{
+    Profiler& profiler;
+    const char* name;
+    std::chrono::high_resolution_clock::time_point start;
+
+public:
+    ProfileZone(Profiler& profiler, const char* name):profiler(profiler),name(name),start(profiler.begin(name)){}
+    ~ProfileZone(){ profiler.end(name, start); }
+};
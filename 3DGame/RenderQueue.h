@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// One frame's draws, sorted so that those sharing state go back to back.
+// Each item gets a 64-bit key: its pass in the top bits, then its material,
+// then its mesh, then its depth, so within a pass items group by material
+// (the costliest to switch), then by mesh, and only then run front to back
+// for early depth rejection, or back to front in a blended pass. Materials
+// and meshes are numbered in the order the queue first sees them, which
+// keeps the order the same from frame to frame.
+template <class T>
+class RenderQueue
+{
+public:
+    static const unsigned int passBits = 4;
+    static const unsigned int idBits = 14;      // materials, and meshes, told apart
+    static const unsigned int depthBits = 64 - passBits - 2 * idBits;
+
+private:
+    struct Item
+    {
+        unsigned long long key;
+        T* item;
+        bool operator<(const Item& o) const { return key < o.key; }
+    };
+    std::vector<Item> items;
+    std::map<const void*, unsigned int> ids;
+    float maxDepth;
+
+    unsigned long long idOf(const void* p)
+    {
+        if(!p)
+            return 0;
+        std::map<const void*, unsigned int>::iterator i = ids.find(p);
+        if(i != ids.end())
+            return i->second;
+        // past the last id everything new shares it, sorting only less well
+        unsigned int id = std::min<unsigned int>(ids.size() + 1, (1u << idBits) - 1);
+        ids[p] = id;
+        return id;
+    }
+
+public:
+    // depths from 0 to maxDepth are told apart, further ones sort as maxDepth
+    RenderQueue(float maxDepth = 1000):maxDepth(maxDepth){}
+
+    void push(unsigned int pass, const void* material, const void* mesh, float depth, bool backToFront, T* item)
+    {
+        unsigned long long depthRange = (1ull << depthBits) - 1;
+        float clamped = std::max(0.0f, std::min(depth / maxDepth, 1.0f));
+        // in double: in float, depthRange rounds up past itself into the mesh id
+        unsigned long long quantized = std::min((unsigned long long)((double)clamped * depthRange), depthRange);
+        if(backToFront)
+            quantized = depthRange - quantized;
+        Item i;
+        i.key = (unsigned long long)pass << (64 - passBits)
+              | idOf(material) << (depthBits + idBits)
+              | idOf(mesh) << depthBits
+              | quantized;
+        i.item = item;
+        items.push_back(i);
+    }
+
+    void sort()
+    {
+        std::sort(items.begin(), items.end());
+    }
+
+    unsigned int size() const { return items.size(); }
+    T* at(unsigned int i) const { return items[i].item; }
+    void clear() { items.clear(); }
+    // ids of materials and meshes that are gone, before their memory is reused
+    void forget() { ids.clear(); }
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <string.h>
+#ifdef HEADLESS
+#include "HeadlessGL.h"
+#else
+#include <OpenGL/gl.h>
+#endif
+
+// The GL state Material::apply and the draws around it set most often, as
+// last set through here: GL_TEXTURE_2D, GL_LIGHTING and GL_BLEND, the depth
+// mask, the front-and-back diffuse, specular and shininess, and the texture
+// bound to unit 0. A call that would set what is already set is dropped and
+// counted instead. Code that changes any of these behind the cache's back
+// (ShadowMap, ImpostorAtlas, texture uploads) is followed by invalidate(),
+// after which the next call of each kind goes through whatever it sets.
+// setEnabled(false) passes every call on, to compare.
+class RenderStateCache
+{
+    enum { Texture2D, Lighting, Blend, capabilityCount };
+    enum { Unknown = -1 };
+
+    int capabilities[capabilityCount];  // Unknown, 0 or 1
+    int depthWrites;
+    GLfloat diffuse[4];
+    GLfloat specular[4];
+    GLfloat shininess;
+    bool diffuseKnown;
+    bool specularKnown;
+    bool shininessKnown;
+    GLuint texture;
+    bool textureKnown;
+    bool enabled;
+    unsigned long issued;
+    unsigned long skipped;
+
+    static int capabilityIndex(GLenum capability)
+    {
+        switch(capability){
+            case GL_TEXTURE_2D: return Texture2D;
+            case GL_LIGHTING: return Lighting;
+            case GL_BLEND: return Blend;
+        }
+        return Unknown;
+    }
+
+    // true if the call is to be made
+    bool change(bool known, bool same)
+    {
+        if(enabled && known && same){
+            skipped++;
+            return false;
+        }
+        issued++;
+        return true;
+    }
+
+    void setCapability(GLenum capability, bool on)
+    {
+        int i = capabilityIndex(capability);
+        if(i == Unknown){
+            issued++;
+            if(on)
+                glEnable(capability);
+            else
+                glDisable(capability);
+            return;
+        }
+        if(!change(capabilities[i] != Unknown, capabilities[i] == (int)on))
+            return;
+        capabilities[i] = on;
+        if(on)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+public:
+    RenderStateCache():enabled(true),issued(0),skipped(0)
+    {
+        invalidate();
+    }
+
+    void setEnabled(bool on) { enabled = on; }
+    bool isEnabled() const { return enabled; }
+
+    // forget everything; the next call of each kind is made
+    void invalidate()
+    {
+        for(int i = 0; i < capabilityCount; i++)
+            capabilities[i] = Unknown;
+        depthWrites = Unknown;
+        diffuseKnown = specularKnown = shininessKnown = textureKnown = false;
+    }
+
+    void enable(GLenum capability) { setCapability(capability, true); }
+    void disable(GLenum capability) { setCapability(capability, false); }
+
+    void depthMask(GLboolean on)
+    {
+        if(!change(depthWrites != Unknown, depthWrites == (on ? 1 : 0)))
+            return;
+        depthWrites = on ? 1 : 0;
+        glDepthMask(on);
+    }
+
+    // GL_FRONT_AND_BACK; GL_DIFFUSE or GL_SPECULAR, four values
+    void materialfv(GLenum name, const GLfloat* values)
+    {
+        GLfloat* last = name == GL_DIFFUSE ? diffuse : specular;
+        bool& known = name == GL_DIFFUSE ? diffuseKnown : specularKnown;
+        if(!change(known, memcmp(last, values, sizeof(diffuse)) == 0))
+            return;
+        memcpy(last, values, sizeof(diffuse));
+        known = true;
+        glMaterialfv(GL_FRONT_AND_BACK, name, values);
+    }
+
+    // GL_FRONT_AND_BACK, GL_SHININESS
+    void materialf(GLenum name, GLfloat value)
+    {
+        if(!change(shininessKnown, shininess == value))
+            return;
+        shininess = value;
+        shininessKnown = true;
+        glMaterialf(GL_FRONT_AND_BACK, name, value);
+    }
+
+    // GL_TEXTURE_2D on texture unit 0
+    void bindTexture(GLuint name)
+    {
+        if(!change(textureKnown, texture == name))
+            return;
+        texture = name;
+        textureKnown = true;
+        glBindTexture(GL_TEXTURE_2D, name);
+    }
+
+    // calls made and calls dropped as redundant since the last resetCounts()
+    unsigned long getIssued() const { return issued; }
+    unsigned long getSkipped() const { return skipped; }
+    void resetCounts() { issued = skipped = 0; }
+};
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include "float3.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SEEKER_KERNEL_SSE 1
+#if defined(__GNUC__) || defined(__clang__)
+#define SEEKER_KERNEL_AVX 1
+#endif
+#endif
+
+// Seeker steering over entity arrays laid out one array per coordinate,
+// run in place: every entity of the seeker kind heads for the target at a
+// fixed speed, faces it, and takes an Euler step unless flagged dead; the
+// others are left as they are. Same arithmetic as the float3 version it replaced, except
+// that the heading's acos is a polynomial (Abramowitz & Stegun 4.4.46,
+// error under 2e-8 rad) and the SIMD paths normalise with a refined rsqrt.
+// Runs 4 seekers at a time with SSE, and one at a time for the tail or on
+// other CPUs. The AVX path (8 at a time, where the CPU has it) measured 2-3x
+// slower than SSE at 10k and 100k seekers in --bench-seekers, so it is only
+// used when asked for.
+struct SeekerBatch
+{
+    float* x;
+    float* y;
+    float* z;
+    float* vx;          // out
+    float* vy;
+    float* vz;
+    float* heading;     // out, degrees
+    const unsigned char* kind;
+    const unsigned char* flags;
+    unsigned char seekerKind;   // the kind that is steered
+    unsigned char deadFlag;     // steered but stays put
+    unsigned int count;
+};
+
+enum SeekerKernelPath { SeekerKernelScalar, SeekerKernelSse, SeekerKernelAvx };
+
+inline const char* seekerKernelName(SeekerKernelPath path)
+{
+    return path == SeekerKernelAvx ? "AVX" : path == SeekerKernelSse ? "SSE" : "scalar";
+}
+
+// acos(|x|) = sqrt(1 - |x|) * p(|x|)
+#define SEEKER_ACOS_COEFFICIENTS \
+    1.5707963050f, -0.2145988016f, 0.0889789874f, -0.0501743046f, \
+    0.0308918810f, -0.0170881256f, 0.0066700901f, -0.0012624911f
+
+inline float seekerAcos(float x)
+{
+    static const float c[8] = { SEEKER_ACOS_COEFFICIENTS };
+    float a = fabsf(x);
+    float p = c[7];
+    for(int i = 6; i >= 0; i--)
+        p = p * a + c[i];
+    float r = sqrtf(1 - a) * p;
+    return x < 0 ? (float)M_PI - r : r;
+}
+
+inline void steerSeekersScalar(const SeekerBatch& b, unsigned int first, float3 target, float speed, float dt)
+{
+    for(unsigned int i = first; i < b.count; i++){
+        if(b.kind[i] != b.seekerKind)
+            continue;
+        float3 direction = (target - float3(b.x[i], b.y[i], b.z[i])).normalize();
+        float3 velocity = direction * speed;
+        float heading = (180 * seekerAcos(direction.z)) / M_PI;
+        if(direction.x < 0)
+            heading = 360 - heading;
+        b.heading[i] = heading + 90;
+        b.vx[i] = velocity.x;
+        b.vy[i] = velocity.y;
+        b.vz[i] = velocity.z;
+        float step = (b.flags[i] & b.deadFlag) ? 0 : dt;
+        b.x[i] += velocity.x * step;
+        b.y[i] += velocity.y * step;
+        b.z[i] += velocity.z * step;
+    }
+}
+
+#ifdef SEEKER_KERNEL_SSE
+// all ones in each of the four lanes from i on that is a seeker, and in
+// move those that are also alive
+inline __m128 seekerLanes(const SeekerBatch& b, unsigned int i, __m128& move)
+{
+    int kinds, flags;
+    memcpy(&kinds, b.kind + i, 4);
+    memcpy(&flags, b.flags + i, 4);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i k = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(kinds), zero), zero);
+    __m128i f = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(flags), zero), zero);
+    __m128i steer = _mm_cmpeq_epi32(k, _mm_set1_epi32(b.seekerKind));
+    __m128i alive = _mm_cmpeq_epi32(_mm_and_si128(f, _mm_set1_epi32(b.deadFlag)), zero);
+    move = _mm_castsi128_ps(_mm_and_si128(steer, alive));
+    return _mm_castsi128_ps(steer);
+}
+
+inline __m128 seekerSelect(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// returns the first entity left for the scalar tail
+inline unsigned int steerSeekersSse(const SeekerBatch& b, float3 target, float speed, float dt)
+{
+    static const float c[8] = { SEEKER_ACOS_COEFFICIENTS };
+    const __m128 tx = _mm_set1_ps(target.x), ty = _mm_set1_ps(target.y), tz = _mm_set1_ps(target.z);
+    const __m128 vSpeed = _mm_set1_ps(speed), vDt = _mm_set1_ps(dt);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1), half = _mm_set1_ps(.5f), threeHalves = _mm_set1_ps(1.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 pi = _mm_set1_ps(M_PI), toDegrees = _mm_set1_ps(180 / M_PI);
+    const __m128 fullTurn = _mm_set1_ps(360), quarterTurn = _mm_set1_ps(90);
+    unsigned int i = 0;
+    for(; i + 4 <= b.count; i += 4){
+        __m128 move;
+        __m128 steer = seekerLanes(b, i, move);
+        if(_mm_movemask_ps(steer) == 0)
+            continue;
+        __m128 px = _mm_loadu_ps(b.x + i), py = _mm_loadu_ps(b.y + i), pz = _mm_loadu_ps(b.z + i);
+        __m128 dx = _mm_sub_ps(tx, px), dy = _mm_sub_ps(ty, py), dz = _mm_sub_ps(tz, pz);
+        __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        // rsqrt is good to 12 bits, one Newton-Raphson step brings it to about 23
+        __m128 r = _mm_rsqrt_ps(length2);
+        r = _mm_mul_ps(r, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, length2), _mm_mul_ps(r, r))));
+        dx = _mm_mul_ps(dx, r);
+        dy = _mm_mul_ps(dy, r);
+        dz = _mm_mul_ps(dz, r);
+        __m128 vx = _mm_mul_ps(dx, vSpeed), vy = _mm_mul_ps(dy, vSpeed), vz = _mm_mul_ps(dz, vSpeed);
+        _mm_storeu_ps(b.vx + i, seekerSelect(steer, vx, _mm_loadu_ps(b.vx + i)));
+        _mm_storeu_ps(b.vy + i, seekerSelect(steer, vy, _mm_loadu_ps(b.vy + i)));
+        _mm_storeu_ps(b.vz + i, seekerSelect(steer, vz, _mm_loadu_ps(b.vz + i)));
+
+        __m128 a = _mm_and_ps(dz, absMask);
+        __m128 p = _mm_set1_ps(c[7]);
+        for(int k = 6; k >= 0; k--)
+            p = _mm_add_ps(_mm_mul_ps(p, a), _mm_set1_ps(c[k]));
+        __m128 angle = _mm_mul_ps(_mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, a), zero)), p);
+        __m128 negative = _mm_cmplt_ps(dz, zero);
+        angle = _mm_or_ps(_mm_and_ps(negative, _mm_sub_ps(pi, angle)), _mm_andnot_ps(negative, angle));
+        __m128 heading = _mm_mul_ps(angle, toDegrees);
+        negative = _mm_cmplt_ps(dx, zero);
+        heading = _mm_or_ps(_mm_and_ps(negative, _mm_sub_ps(fullTurn, heading)), _mm_andnot_ps(negative, heading));
+        _mm_storeu_ps(b.heading + i, seekerSelect(steer, _mm_add_ps(heading, quarterTurn), _mm_loadu_ps(b.heading + i)));
+
+        __m128 step = _mm_and_ps(move, vDt);
+        _mm_storeu_ps(b.x + i, _mm_add_ps(px, _mm_mul_ps(vx, step)));
+        _mm_storeu_ps(b.y + i, _mm_add_ps(py, _mm_mul_ps(vy, step)));
+        _mm_storeu_ps(b.z + i, _mm_add_ps(pz, _mm_mul_ps(vz, step)));
+    }
+    return i;
+}
+#endif
+
+#ifdef SEEKER_KERNEL_AVX
+__attribute__((target("avx")))
+inline unsigned int steerSeekersAvx(const SeekerBatch& b, float3 target, float speed, float dt)
+{
+    static const float c[8] = { SEEKER_ACOS_COEFFICIENTS };
+    const __m256 tx = _mm256_set1_ps(target.x), ty = _mm256_set1_ps(target.y), tz = _mm256_set1_ps(target.z);
+    const __m256 vSpeed = _mm256_set1_ps(speed), vDt = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), half = _mm256_set1_ps(.5f), threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 pi = _mm256_set1_ps(M_PI), toDegrees = _mm256_set1_ps(180 / M_PI);
+    const __m256 fullTurn = _mm256_set1_ps(360), quarterTurn = _mm256_set1_ps(90);
+    unsigned int i = 0;
+    for(; i + 8 <= b.count; i += 8){
+        // the masks are built 4 lanes at a time, integer compares wanting AVX2
+        __m128 moveLow, moveHigh;
+        __m128 steerLow = seekerLanes(b, i, moveLow), steerHigh = seekerLanes(b, i + 4, moveHigh);
+        if(_mm_movemask_ps(_mm_or_ps(steerLow, steerHigh)) == 0)
+            continue;
+        __m256 steer = _mm256_insertf128_ps(_mm256_castps128_ps256(steerLow), steerHigh, 1);
+        __m256 move = _mm256_insertf128_ps(_mm256_castps128_ps256(moveLow), moveHigh, 1);
+        __m256 px = _mm256_loadu_ps(b.x + i), py = _mm256_loadu_ps(b.y + i), pz = _mm256_loadu_ps(b.z + i);
+        __m256 dx = _mm256_sub_ps(tx, px), dy = _mm256_sub_ps(ty, py), dz = _mm256_sub_ps(tz, pz);
+        __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        __m256 r = _mm256_rsqrt_ps(length2);
+        r = _mm256_mul_ps(r, _mm256_sub_ps(threeHalves, _mm256_mul_ps(_mm256_mul_ps(half, length2), _mm256_mul_ps(r, r))));
+        dx = _mm256_mul_ps(dx, r);
+        dy = _mm256_mul_ps(dy, r);
+        dz = _mm256_mul_ps(dz, r);
+        __m256 vx = _mm256_mul_ps(dx, vSpeed), vy = _mm256_mul_ps(dy, vSpeed), vz = _mm256_mul_ps(dz, vSpeed);
+        _mm256_storeu_ps(b.vx + i, _mm256_blendv_ps(_mm256_loadu_ps(b.vx + i), vx, steer));
+        _mm256_storeu_ps(b.vy + i, _mm256_blendv_ps(_mm256_loadu_ps(b.vy + i), vy, steer));
+        _mm256_storeu_ps(b.vz + i, _mm256_blendv_ps(_mm256_loadu_ps(b.vz + i), vz, steer));
+
+        __m256 a = _mm256_and_ps(dz, absMask);
+        __m256 p = _mm256_set1_ps(c[7]);
+        for(int k = 6; k >= 0; k--)
+            p = _mm256_add_ps(_mm256_mul_ps(p, a), _mm256_set1_ps(c[k]));
+        __m256 angle = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(one, a), zero)), p);
+        angle = _mm256_blendv_ps(angle, _mm256_sub_ps(pi, angle), _mm256_cmp_ps(dz, zero, _CMP_LT_OQ));
+        __m256 heading = _mm256_mul_ps(angle, toDegrees);
+        heading = _mm256_blendv_ps(heading, _mm256_sub_ps(fullTurn, heading), _mm256_cmp_ps(dx, zero, _CMP_LT_OQ));
+        _mm256_storeu_ps(b.heading + i, _mm256_blendv_ps(_mm256_loadu_ps(b.heading + i), _mm256_add_ps(heading, quarterTurn), steer));
+
+        __m256 step = _mm256_and_ps(move, vDt);
+        _mm256_storeu_ps(b.x + i, _mm256_add_ps(px, _mm256_mul_ps(vx, step)));
+        _mm256_storeu_ps(b.y + i, _mm256_add_ps(py, _mm256_mul_ps(vy, step)));
+        _mm256_storeu_ps(b.z + i, _mm256_add_ps(pz, _mm256_mul_ps(vz, step)));
+    }
+    return i;
+}
+#endif
+
+// whether this build and CPU can run the path
+inline bool isSeekerKernelAvailable(SeekerKernelPath path)
+{
+#ifdef SEEKER_KERNEL_AVX
+    if(path == SeekerKernelAvx)
+        return __builtin_cpu_supports("avx");
+#endif
+#ifdef SEEKER_KERNEL_SSE
+    if(path == SeekerKernelSse)
+        return true;
+#endif
+    return path == SeekerKernelScalar;
+}
+
+// the default, the fastest path --bench-seekers has measured
+inline SeekerKernelPath bestSeekerKernel()
+{
+    return isSeekerKernelAvailable(SeekerKernelSse) ? SeekerKernelSse : SeekerKernelScalar;
+}
+
+// "scalar", "sse" or "avx"; false if the name is unknown or the path unavailable
+inline bool parseSeekerKernel(const char* name, SeekerKernelPath& path)
+{
+    const char* names[3] = { "scalar", "sse", "avx" };
+    for(int i = 0; i < 3; i++)
+        if(strcmp(name, names[i]) == 0 && isSeekerKernelAvailable((SeekerKernelPath)i)){
+            path = (SeekerKernelPath)i;
+            return true;
+        }
+    return false;
+}
+
+inline void steerSeekers(const SeekerBatch& b, float3 target, float speed, float dt, SeekerKernelPath path)
+{
+    unsigned int done = 0;
+#ifdef SEEKER_KERNEL_AVX
+    if(path == SeekerKernelAvx)
+        done = steerSeekersAvx(b, target, speed, dt);
+#endif
+#ifdef SEEKER_KERNEL_SSE
+    if(path == SeekerKernelSse)
+        done = steerSeekersSse(b, target, speed, dt);
+#endif
+    steerSeekersScalar(b, done, target, speed, dt);
+}
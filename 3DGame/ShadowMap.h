@@ -0,0 +1,235 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef HEADLESS
+#include "HeadlessGL.h"
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glu.h>
+#endif
+#include "float3.h"
+
+// Shadows from a directional light through a depth texture, all fixed
+// function: begin()/end() bracket a depth-only pass drawn from the light
+// with an orthographic box of halfExtent around a focus point, and
+// bindReceiver() sets up texture unit 1 so whatever is drawn next (the
+// ground) is darkened to shadowColor where the map says it is hidden from
+// the light. The lookup uses eye-linear texgen with the light's bias *
+// projection * view as planes, given while the modelview holds the camera,
+// so GL maps eye coordinates back to the light; the comparison is ARB_shadow
+// and the blend a GL_INTERPOLATE combiner. Needs EXT_framebuffer_object,
+// ARB_depth_texture and ARB_shadow.
+class ShadowMap
+{
+    GLuint texture;
+    GLuint framebuffer;
+    int size;
+    float halfExtent;
+    float3 shadowColor;
+    GLfloat lightMatrix[16];    // bias * projection * view, column-major
+    GLint savedViewport[4];
+    bool initialized;
+    bool available;
+    bool rendered;
+
+    static bool hasExtension(const char* extensions, const char* name)
+    {
+        return strstr(extensions, name) != NULL;
+    }
+
+    void initialize()
+    {
+        initialized = true;
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        if(!extensions || !hasExtension(extensions, "GL_EXT_framebuffer_object")
+           || !hasExtension(extensions, "GL_ARB_depth_texture") || !hasExtension(extensions, "GL_ARB_shadow")){
+            printf("shadow map: not supported, drawing planar shadows\n");
+            return;
+        }
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // beyond the box nothing is in shadow
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        GLfloat border[] = { 1, 1, 1, 1 };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_COMPARE_R_TO_TEXTURE_ARB);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC_ARB, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_2D, GL_DEPTH_TEXTURE_MODE_ARB, GL_INTENSITY);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffersEXT(1, &framebuffer);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        if(status != GL_FRAMEBUFFER_COMPLETE_EXT){
+            printf("shadow map: framebuffer incomplete (0x%x), drawing planar shadows\n", status);
+            glDeleteFramebuffersEXT(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            return;
+        }
+        printf("shadow map: %dx%d over %.0f units\n", size, size, 2 * halfExtent);
+        available = true;
+    }
+
+    // c = a * b, column-major
+    static void multiply(const GLfloat* a, const GLfloat* b, GLfloat* c)
+    {
+        for(int column = 0; column < 4; column++)
+            for(int row = 0; row < 4; row++){
+                GLfloat sum = 0;
+                for(int k = 0; k < 4; k++)
+                    sum += a[k * 4 + row] * b[column * 4 + k];
+                c[column * 4 + row] = sum;
+            }
+    }
+
+public:
+    ShadowMap(int size = 1024, float halfExtent = 80):texture(0),framebuffer(0),size(size),halfExtent(halfExtent),
+        shadowColor(0.1, 0.1, 0.1),initialized(false),available(false),rendered(false){}
+
+    ~ShadowMap()
+    {
+        if(framebuffer)
+            glDeleteFramebuffersEXT(1, &framebuffer);
+        if(texture)
+            glDeleteTextures(1, &texture);
+    }
+
+    // texels per side, before the first frame; 0 turns shadow mapping off
+    void setSize(int texels)
+    {
+        if(initialized)
+            return;
+        size = texels;
+        if(size == 0)
+            initialized = true;
+    }
+
+    // needs the GL context; false means callers draw planar shadows
+    bool isAvailable()
+    {
+        if(!initialized)
+            initialize();
+        return available;
+    }
+
+    // false if a sphere cannot reach the map that begin() with the same light
+    // and focus would render: it is further from the light's axis through focus
+    // than the corners of the box
+    bool mayCast(float3 lightDir, float3 focus, float3 center, float radius) const
+    {
+        float3 toLight = lightDir.normalize();
+        float3 offset = center - focus;
+        float3 across = offset - toLight * offset.dot(toLight);
+        float reach = halfExtent * 1.4143f + radius;
+        return across.norm2() <= reach * reach;
+    }
+
+    // lightDir points towards the light; everything drawn until end() casts shadows
+    bool begin(float3 lightDir, float3 focus)
+    {
+        rendered = false;
+        if(!isAvailable())
+            return false;
+        float distance = 2 * halfExtent;
+        float3 toLight = lightDir.normalize();
+        float3 eye = focus + toLight * distance;
+        float3 up = fabsf(toLight.y) > 0.99f ? float3(0, 0, 1) : float3(0, 1, 0);
+
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(-halfExtent, halfExtent, -halfExtent, halfExtent, 0, 2 * distance);
+        GLfloat projection[16];
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        gluLookAt(eye.x, eye.y, eye.z, focus.x, focus.y, focus.z, up.x, up.y, up.z);
+        GLfloat view[16];
+        glGetFloatv(GL_MODELVIEW_MATRIX, view);
+
+        // clip space -1..1 to texture space 0..1
+        static const GLfloat bias[16] = { .5, 0, 0, 0,  0, .5, 0, 0,  0, 0, .5, 0,  .5, .5, .5, 1 };
+        GLfloat biasedProjection[16];
+        multiply(bias, projection, biasedProjection);
+        multiply(biasedProjection, view, lightMatrix);
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_TEXTURE_2D);
+        // pushes depths back a little so lit surfaces do not shadow themselves
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2, 4);
+        return true;
+    }
+
+    void end()
+    {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glEnable(GL_TEXTURE_2D);
+        glEnable(GL_LIGHTING);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        rendered = true;
+    }
+
+    // call with the camera's view in the modelview; false if there is no map this frame
+    bool bindReceiver()
+    {
+        if(!rendered)
+            return false;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glEnable(GL_TEXTURE_2D);
+        const GLenum coordinates[4] = { GL_S, GL_T, GL_R, GL_Q };
+        const GLenum generators[4] = { GL_TEXTURE_GEN_S, GL_TEXTURE_GEN_T, GL_TEXTURE_GEN_R, GL_TEXTURE_GEN_Q };
+        for(int i = 0; i < 4; i++){
+            GLfloat plane[4] = { lightMatrix[i], lightMatrix[4 + i], lightMatrix[8 + i], lightMatrix[12 + i] };
+            glTexGeni(coordinates[i], GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+            glTexGenfv(coordinates[i], GL_EYE_PLANE, plane);
+            glEnable(generators[i]);
+        }
+        // colour = lit ? previous : shadowColor
+        GLfloat constant[4] = { shadowColor.x, shadowColor.y, shadowColor.z, 1 };
+        glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, constant);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+        glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_INTERPOLATE);
+        glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB, GL_PREVIOUS);
+        glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_RGB, GL_CONSTANT);
+        glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE2_RGB, GL_TEXTURE);
+        glActiveTexture(GL_TEXTURE0);
+        return true;
+    }
+
+    void unbindReceiver()
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glDisable(GL_TEXTURE_GEN_S);
+        glDisable(GL_TEXTURE_GEN_T);
+        glDisable(GL_TEXTURE_GEN_R);
+        glDisable(GL_TEXTURE_GEN_Q);
+        glDisable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        glActiveTexture(GL_TEXTURE0);
+    }
+};
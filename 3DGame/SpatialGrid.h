@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "float3.h"
+
+// Uniform grid over the x/z plane of the arena for neighbour queries.
+// build() buckets every item by the cell of its getPosition() with a counting
+// sort, so each cell's items are contiguous; positions outside the arena land
+// in the border cells. query() returns the items in every cell the query box
+// touches, callers still do the exact distance test.
+// Items that jump after build() have to be reported: relocate() moves one to
+// a short list that every query also returns. Items that die stay until the
+// next build(); Scene deletes them only after the last query of the tick.
+template <class T>
+class SpatialGrid
+{
+    float halfExtent;
+    float cellSize;
+    int cellsPerSide;
+    std::vector<unsigned int> cellStart;    // items of cell c are [cellStart[c], cellStart[c + 1])
+    std::vector<T*> items;                  // NULL once relocated
+    std::vector<T*> moved;
+    std::vector<int> itemCells;
+    std::vector<unsigned int> cursor;
+
+    int column(float x) const
+    {
+        int c = (int)((x + halfExtent) / cellSize);
+        return std::min(std::max(c, 0), cellsPerSide - 1);
+    }
+
+    int cellOf(float3 p) const
+    {
+        return column(p.z) * cellsPerSide + column(p.x);
+    }
+
+    // clears the item's slot in the given cell, false if it is not there
+    bool removeFromCell(T* item, int cell)
+    {
+        for(unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++){
+            if(items[i] == item){
+                items[i] = NULL;
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    SpatialGrid(float halfExtent, float cellSize):halfExtent(halfExtent),cellSize(cellSize)
+    {
+        cellsPerSide = std::max(1, (int)ceil(2 * halfExtent / cellSize));
+        cellStart.assign(cellsPerSide * cellsPerSide + 1, 0);
+    }
+
+    void build(const std::vector<T*>& objects)
+    {
+        itemCells.resize(objects.size());
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for(unsigned int i = 0; i < objects.size(); i++){
+            itemCells[i] = cellOf(objects[i]->getPosition());
+            cellStart[itemCells[i] + 1]++;
+        }
+        for(unsigned int c = 1; c < cellStart.size(); c++)
+            cellStart[c] += cellStart[c - 1];
+        cursor.assign(cellStart.begin(), cellStart.end() - 1);
+        items.resize(objects.size());
+        for(unsigned int i = 0; i < objects.size(); i++)
+            items[cursor[itemCells[i]]++] = objects[i];
+        moved.clear();
+    }
+
+    // appends everything within radius of center on x/z, plus a few farther away
+    void query(float3 center, float radius, std::vector<T*>& out) const
+    {
+        int x0 = column(center.x - radius), x1 = column(center.x + radius);
+        int z0 = column(center.z - radius), z1 = column(center.z + radius);
+        for(int z = z0; z <= z1; z++){
+            for(int x = x0; x <= x1; x++){
+                int cell = z * cellsPerSide + x;
+                for(unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                    if(items[i])
+                        out.push_back(items[i]);
+            }
+        }
+        out.insert(out.end(), moved.begin(), moved.end());
+    }
+
+    // call after the item moved from oldPosition
+    void relocate(T* item, float3 oldPosition)
+    {
+        if(std::find(moved.begin(), moved.end(), item) != moved.end())
+            return;
+        if(!removeFromCell(item, cellOf(oldPosition)))
+            std::replace(items.begin(), items.end(), item, (T*)NULL);
+        moved.push_back(item);
+    }
+};
@@ -2,6 +2,10 @@
 #include <math.h>
 #include <stdlib.h>
 
+#ifdef HEADLESS
+// simulation only, see HeadlessGL.h
+#include "HeadlessGL.h"
+#else
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 // Needed on MsWindows
 #include <windows.h>
@@ -11,17 +15,41 @@
 #include <OpenGL/glu.h>
 // Download glut from: http://www.opengl.org/resources/libraries/glut/
 #include <GLUT/glut.h>
+#endif
+// counts the GL calls made from here on, see GLStats.h
+#include "GLStats.h"
 
 #include "float2.h"
 #include "float3.h"
 #include "stb_image.h"
 #include "meshpack/Mesh.h"
+#include "AssetRegistry.h"
+#include "InstanceRenderer.h"
+#include "ShadowMap.h"
+#include "Impostor.h"
+#include "RenderState.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
+#include "SpatialGrid.h"
+#include "EntityStore.h"
+#include "ObjectPool.h"
+#include "Profiler.h"
+#include "GpuTimer.h"
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <map>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstddef>
 
 int dimension = 200;
 static int score = 1;
+// buffer objects for meshes and the ground/billboard quads; --legacy-gl switches
+// back to display lists and immediate mode so the two can be compared
+bool useBufferObjects = true;
 class LightSource
 {
 public:
@@ -81,8 +109,25 @@ public:
     }
 };
 
+// texture, lighting, blending and material state goes through here so that
+// repeating what is already set costs nothing; draws of objects set what they
+// need up front instead of restoring it after. --no-state-cache to compare.
+RenderStateCache renderState;
+
 class Material
 {
+protected:
+    void applyColors()
+    {
+        float aglDiffuse[] = {kd.x, kd.y, kd.z, 1.0f};
+        renderState.materialfv(GL_DIFFUSE, aglDiffuse);
+        float aglSpecular[] = {kd.x, kd.y, kd.z, 1.0f};
+        renderState.materialfv(GL_SPECULAR, aglSpecular);
+        if(shininess <= 128)
+            renderState.materialf(GL_SHININESS, shininess);
+        else
+            renderState.materialf(GL_SHININESS, 128.0f);
+    }
 public:
     float3 kd;			// diffuse reflection coefficient
     float3 ks;			// specular reflection coefficient
@@ -93,32 +138,52 @@ public:
         ks = float3(1, 1, 1);
         shininess = 15;
     }
+    // no random color: textured materials come from a registry, which only
+    // constructs one on a miss, and the random sequence of a game must not
+    // depend on what a previous game left resident
+    Material(float3 kd):kd(kd),ks(1, 1, 1),shininess(15){}
+    virtual ~Material(){}
+    // false while what apply() sets is still loading
+    virtual bool isReady(){
+        return true;
+    }
     virtual void apply()
     {
-        glDisable(GL_TEXTURE_2D);
-        float aglDiffuse[] = {kd.x, kd.y, kd.z, 1.0f};
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, aglDiffuse);
-        float aglSpecular[] = {kd.x, kd.y, kd.z, 1.0f};
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, aglSpecular);
-        if(shininess <= 128)
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
-        else
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 128.0f);
+        renderState.disable(GL_TEXTURE_2D);
+        applyColors();
     }
 };
 
 class TexturedMaterial : public Material{
+    std::string filename;
     unsigned int textureName;
+    unsigned char* data;
+    int width;
+    int height;
+    int nComponents;
+    bool ready;
 public:
+    // only records the file; prepare() decodes it, upload() creates the texture
     TexturedMaterial(const char* filename,
                      GLint filtering = GL_LINEAR_MIPMAP_LINEAR
-                     ){
-        unsigned char* data;
-        int width;
-        int height;
-        int nComponents = 4;
-        data = stbi_load(filename, &width, &height, &nComponents,
+                     ):Material(float3(1, 1, 1)),filename(filename),textureName(0),data(NULL),width(0),height(0),nComponents(4),ready(false){
+    }
+    
+    virtual ~TexturedMaterial(){
+        if(textureName)
+            glDeleteTextures(1, &textureName);
+        if(data)
+            stbi_image_free(data);
+    }
+    
+    // decoding only, safe off the GL thread
+    void prepare(){
+        data = stbi_load(filename.c_str(), &width, &height, &nComponents,
                          0);
+    }
+    
+    void upload(){
+        ready = true;
         if(data == NULL) return;
         
         glGenTextures(1, &textureName);  // id generation
@@ -132,19 +197,71 @@ public:
                               GL_RGB, GL_UNSIGNED_BYTE, data);
         glTexEnvi(GL_TEXTURE_ENV,
                   GL_TEXTURE_ENV_MODE, GL_REPLACE);
-        delete data;
+        stbi_image_free(data);
+        data = NULL;
     }
     
+    bool isReady(){
+        return ready;
+    }
+    
+    // untextured until the image is uploaded
     void apply(){
-        this->Material::apply();
-        glEnable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, textureName);
+        applyColors();
+        if(!ready){
+            renderState.disable(GL_TEXTURE_2D);
+            return;
+        }
+        renderState.enable(GL_TEXTURE_2D);
+        renderState.bindTexture(textureName);
     }
     
 
 
 };
 
+// meshes and textures outlive Scene::restart, a new game reuses what is resident;
+// they load in the background and are uploaded a few per frame in onDisplay
+AssetLoader assetLoader;
+AssetRegistry<Mesh> meshRegistry(&assetLoader);
+AssetRegistry<TexturedMaterial> textureRegistry(&assetLoader);
+const double uploadBudgetMs = 4.0;
+
+// trees, seekers and bullets sharing a mesh and material go out as one
+// instanced draw; bullets use a sphere mesh instead of glutSolidSphere there
+InstanceRenderer instanceRenderer;
+// shadows of live objects on the ground; --shadow-map 0 goes back to planar shadows
+ShadowMap shadowMap;
+Mesh* bulletSphere = NULL;
+unsigned int drawCalls = 0;     // this frame, an instanced batch counts once
+// objects outside the view are not submitted; --no-cull draws everything to compare
+bool frustumCulling = true;
+unsigned int objectsDrawn = 0;  // this frame, live objects with a bound (not the ground)
+unsigned int objectsCulled = 0;
+// meshes are drawn at the coarsest level of detail whose error stays under
+// this many pixels on screen; --lod-error 0 always draws them in full
+float lodPixelError = 1;
+unsigned long trianglesFull = 0;    // this frame, of the meshes drawn, at full detail
+unsigned long trianglesDrawn = 0;   // and at the levels picked, an impostor counting as two
+// trees and seekers further than this are drawn as a picture from their
+// mesh's impostor atlas, fading over from the mesh across the band before
+// it; --impostor-distance 0 always draws the meshes
+float impostorDistance = 120;
+const float impostorFadeBand = 20;
+unsigned int impostorsDrawn = 0;    // this frame, those fading over included
+// one per mesh and material, rendered when first needed and kept like the
+// meshes and textures they show
+typedef std::map<std::pair<Mesh*, Material*>, ImpostorAtlas*> ImpostorAtlases;
+ImpostorAtlases impostorAtlases;
+// CPU time of the simulation and drawing zones, shown with 'p'
+Profiler profiler;
+bool showProfile = false;
+const char* tracePath = NULL;   // --trace: Chrome trace JSON written on exit
+// GPU time per render pass and the GL calls of the last finished frame
+GpuTimer gpuTimer;
+GLStats lastFrameGL;
+FILE* glStatsLog = NULL;        // --gl-stats: one CSV line per frame
+
 class Camera
 {
     float3 eye;
@@ -156,7 +273,10 @@ class Camera
     
     float fov;
     float aspect;
-    friend class Billboard;
+    float zNear;
+    float zFar;
+    int viewportHeight;
+    Frustum frustum;
     friend class ScoreCount;
     float2 lastMousePos;
     float2 mouseDelta;
@@ -175,24 +295,57 @@ public:
         
         fov = 1.1;
         aspect  = 1;
+        zNear = 0.1;
+        zFar = 500;
+        viewportHeight = 600;
     }
     
     void apply()
     {
         glMatrixMode(GL_PROJECTION);
         glLoadIdentity();
-        gluPerspective(fov /3.14*180, aspect, 0.1, 500);
+        gluPerspective(fov /3.14*180, aspect, zNear, zFar);
         glMatrixMode(GL_MODELVIEW);
         glLoadIdentity();
         gluLookAt(eye.x, eye.y, eye.z, lookAt.x, lookAt.y, lookAt.z, 0.0, 1.0, 0.0);
+        // gluPerspective's angle is fov/3.14*180 degrees, so is the frustum's
+        frustum.set(eye, lookAt, float3(0, 1, 0), fov / 3.14 * M_PI, aspect, zNear, zFar);
+    }
+    
+    // the view as of the last apply()
+    const Frustum& getFrustum()
+    {
+        return frustum;
+    }
+    
+    // turns a quad in the xy plane to face the camera, column-major
+    void getBillboardRotation(float m[16])
+    {
+        float rotation[] = {
+            right.x, right.y, right.z, 0,
+            up.x, up.y, up.z, 0,
+            ahead.x, ahead.y, ahead.z, 0,
+            0, 0, 0, 1 };
+        memcpy(m, rotation, sizeof(rotation));
     }
     
     void setAspectRatio(float ar) { aspect= ar; }
+    void setViewportHeight(int height) { viewportHeight = height; }
+    
+    // how many pixels one unit spans at the given distance from the eye
+    float getPixelsPerUnit(float distance)
+    {
+        return viewportHeight / (2 * tan(fov / 3.14 * M_PI / 2) * std::max(distance, zNear));
+    }
     
     void move(float3 position, float orientation, float dt, std::vector<bool>& keysPressed)
     {
-        
-        
+        follow(position, orientation);
+    }
+    
+    // behind and above the given position, looking along the orientation
+    void follow(float3 position, float orientation)
+    {
         ahead.x = cos(2*M_PI*(-orientation + 90)/360);
         ahead.y = 0;
         ahead.z = sin(2*M_PI*(-orientation + 90)/360);
@@ -219,19 +372,61 @@ public:
     
 };
 
+// A static quad in a buffer object, drawn as a four-vertex triangle strip
+// with interleaved position and texcoord.
+class QuadBuffer
+{
+    struct Vertex
+    {
+        float3 position;
+        float2 texcoord;
+    };
+    Vertex vertices[4];
+    GLuint buffer;
+public:
+    QuadBuffer(const float3 positions[4], const float2 texcoords[4]):buffer(0){
+        for(int i = 0; i < 4; i++){
+            vertices[i].position = positions[i];
+            vertices[i].texcoord = texcoords[i];
+        }
+    }
+    ~QuadBuffer(){
+        if(buffer)
+            glDeleteBuffers(1, &buffer);
+    }
+    
+    void draw(){
+        if(!buffer){
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+        }
+        else
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, texcoord));
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
+
 void * font= GLUT_BITMAP_TIMES_ROMAN_24;
 
 void renderBitmapString(float x, float y, float z, void *font, const char *string){
     const char *c;
     glRasterPos3f(x, y, z);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_LIGHTING);
+    renderState.disable(GL_TEXTURE_2D);
+    renderState.disable(GL_LIGHTING);
     
     for (c=string; *c != '\0'; c++) {
         glutBitmapCharacter(font, *c);
     }
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_LIGHTING);
+    renderState.enable(GL_TEXTURE_2D);
+    renderState.enable(GL_LIGHTING);
 }
 
 class ScoreCount
@@ -251,11 +446,17 @@ public:
 };
 
 
+static const float3 billboardCorners[4] = {
+    float3(-1, -1, 0), float3(-1, 1, 0), float3(1, -1, 0), float3(1, 1, 0) };
+static const float2 billboardTexcoords[4] = {
+    float2(0, 0), float2(0, 1), float2(1, 0), float2(1, 1) };
+
 class Billboard{
     float3 position;
     Material* material;
+    QuadBuffer quad;
 public:
-    Billboard(Material* m){
+    Billboard(Material* m):quad(billboardCorners, billboardTexcoords){
         material = m;
     }
     
@@ -265,42 +466,42 @@ public:
     
     virtual void draw(Camera& c){
         
-        glDisable(GL_LIGHTING);
-        glEnable(GL_BLEND);
+        renderState.disable(GL_LIGHTING);
+        renderState.enable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glDepthMask(GL_FALSE);
+        renderState.depthMask(GL_FALSE);
         
         material->apply();
         
         glPushMatrix();
         glTranslatef(position.x,position.y,position.z);
         glScalef(5,5,5);
-        float camRotation[] = {
-            c.right.x, c.right.y, c.right.z, 0,
-            c.up.x, c.up.y, c.up.z, 0,
-            c.ahead.x, c.ahead.y, c.ahead.z, 0,
-            0, 0, 0, 1 };
+        float camRotation[16];
+        c.getBillboardRotation(camRotation);
         glMultMatrixf(camRotation);
         glColor4d(1,1,1,1);
         
-        
-        glBegin(GL_QUADS);
-        glTexCoord3d(0,0,0);
-        glVertex3f(-1, -1, 0);
-        
-        glTexCoord3d(0,1,0);
-        glVertex3f(-1, 1, 0);
-        
-        glTexCoord3d(1,1,0);
-        glVertex3f(1, 1, 0);
-        
-        glTexCoord3d(1,0,0);
-        glVertex3f(1, -1, 0);
-        glEnd();
+        if(useBufferObjects)
+            quad.draw();
+        else{
+            glBegin(GL_QUADS);
+            glTexCoord3d(0,0,0);
+            glVertex3f(-1, -1, 0);
+            
+            glTexCoord3d(0,1,0);
+            glVertex3f(-1, 1, 0);
+            
+            glTexCoord3d(1,1,0);
+            glVertex3f(1, 1, 0);
+            
+            glTexCoord3d(1,0,0);
+            glVertex3f(1, -1, 0);
+            glEnd();
+        }
         glPopMatrix();
-        glDisable(GL_BLEND);
-        glDepthMask(GL_TRUE);
-        glEnable(GL_LIGHTING);
+        renderState.disable(GL_BLEND);
+        renderState.depthMask(GL_TRUE);
+        renderState.enable(GL_LIGHTING);
 
     }
 
@@ -308,69 +509,195 @@ public:
 
 ScoreCount sc;
 
+// simulation state of all objects, see EntityStore.h
+EntityStore entities;
+
 class Object
 {
 protected:
     Material* material;
-    float3 scaleFactor;
-    float3 position;
     float3 orientationAxis;
-    float orientationAngle;
-    bool isDead = false;
-    bool isHazard = false;
-    bool isEnemy = false;
-    bool isTeapot = false;
-    bool isAvatar = false;
+    // position, velocity, orientation, scale and flags live in the entity store
+    unsigned int entity;
+    
+    Float3Ref position(){ return entities.position[entity]; }
+    Float3Ref velocity(){ return entities.velocity[entity]; }
+    float3& scaleFactor(){ return entities.scale[entity]; }
+    float& orientationAngle(){ return entities.orientation[entity]; }
+    float& angularVelocity(){ return entities.angularVelocity[entity]; }
+    void setKind(EntityStore::Kind kind){ entities.kind[entity] = kind; }
+    void setFlag(EntityStore::Flag flag){ entities.flags[entity] |= flag; }
+    bool hasFlag(EntityStore::Flag flag){ return entities.flags[entity] & flag; }
+    
+    static std::vector<Object*> nearby;     // scratch for grid queries in control()
+    
+    // translation, orientation and scaling between the last two simulation states
+    void applyTransform(){
+        float3 p = getRenderPosition();
+        glTranslatef(p.x, p.y, p.z);
+        glRotatef(getRenderOrientation(), orientationAxis.x, orientationAxis.y, orientationAxis.z);
+        glScalef(scaleFactor().x, scaleFactor().y, scaleFactor().z);
+    }
     
 public:
-    Object(Material* material):material(material),orientationAngle(0.0f),scaleFactor(1.0,1.0,1.0),orientationAxis(0.0,1.0,0.0){}
-    virtual ~Object(){}
+    // how far drawing is from the previous simulation state towards the current one, 0..1
+    static float interpolation;
+    
+    Object(Material* material):material(material),orientationAxis(0.0,1.0,0.0){
+        entities.create(EntityStore::Static, &entity);
+    }
+    virtual ~Object(){
+        entities.destroy(entity);
+    }
     Object* translate(float3 offset){
-        position += offset; return this;
+        position() += offset; return this;
     }
     Object* scale(float3 factor){
-        scaleFactor *= factor; return this;
+        scaleFactor() *= factor; return this;
     }
     Object* rotate(float angle){
-        orientationAngle += angle; return this;
+        orientationAngle() += angle; return this;
     }
     
     float3 getPosition(){
-        return position;
+        return position();
     }
     
     float3 setPosition(float3 p){
-        return position = p;
+        return position() = p;
     }
 
     
     float getOrientation(){
-        return orientationAngle;
+        return orientationAngle();
+    }
+    
+    // after a jump that should not be blended; EntityStore::savePreviousState does all before a step
+    void savePreviousState(){
+        entities.previousPosition[entity] = position();
+        entities.previousOrientation[entity] = orientationAngle();
+    }
+    
+    float3 getRenderPosition(){
+        float3 previous = entities.previousPosition[entity];
+        return previous + (position() - previous) * interpolation;
+    }
+    
+    float getRenderOrientation(){
+        float previous = entities.previousOrientation[entity];
+        float turn = orientationAngle() - previous;
+        while(turn > 180)
+            turn -= 360;
+        while(turn < -180)
+            turn += 360;
+        return previous + turn * interpolation;
+    }
+    
+    unsigned int getEntity(){
+        return entity;
     }
     
     bool getIsHazard(){
-        return isHazard;
+        return hasFlag(EntityStore::Hazard);
     }
     bool getIsEnemy(){
-        return isEnemy;
+        return hasFlag(EntityStore::Enemy);
     }
     bool getIsTeapot(){
-        return isTeapot;
+        return hasFlag(EntityStore::Teapot);
     }
     bool getIsDead(){
-        return isDead;
+        return hasFlag(EntityStore::Dead);
+    }
+    float getTimeDead(){
+        return entities.timeDead[entity];
     }
     
     bool getIsAvatar(){
-        return isAvatar;
+        return hasFlag(EntityStore::Avatar);
+    }
+    
+    Material* getMaterial(){
+        return material;
+    }
+    
+    // the mesh to batch this object under, NULL to draw it on its own
+    virtual Mesh* getInstancedMesh(){
+        return NULL;
+    }
+    // the mesh drawModel() draws, and the level of detail it uses for it
+    virtual Mesh* getMesh(){
+        return NULL;
+    }
+    virtual void setLod(unsigned int lod){}
+    // far away, draw a picture of getMesh() instead; the mesh must look the
+    // same from any height, the pictures are taken from the side
+    virtual bool getHasImpostor(){
+        return false;
+    }
+    virtual bool getIsLit(){
+        return true;
+    }
+    // allocated from an ObjectPool and owning nothing but its entity, so
+    // Scene::restart can drop it with the pool instead of deleting it
+    virtual bool getIsPooled(){
+        return false;
+    }
+    
+    // the model matrix draw() builds (translate, rotate, scale), column-major
+    void getTransform(float m[16]){
+        float3 axis = orientationAxis.normalize();
+        float3 p = getRenderPosition();
+        float a = getRenderOrientation() * M_PI / 180;
+        float c = cos(a), s = sin(a), t = 1 - c;
+        float r[3][3] = {
+            { axis.x*axis.x*t + c,        axis.x*axis.y*t - axis.z*s, axis.x*axis.z*t + axis.y*s },
+            { axis.y*axis.x*t + axis.z*s, axis.y*axis.y*t + c,        axis.y*axis.z*t - axis.x*s },
+            { axis.z*axis.x*t - axis.y*s, axis.z*axis.y*t + axis.x*s, axis.z*axis.z*t + c } };
+        float scales[3] = { scaleFactor().x, scaleFactor().y, scaleFactor().z };
+        for(int column = 0; column < 3; column++){
+            for(int row = 0; row < 3; row++)
+                m[column * 4 + row] = r[row][column] * scales[column];
+            m[column * 4 + 3] = 0;
+        }
+        m[12] = p.x;
+        m[13] = p.y;
+        m[14] = p.z;
+        m[15] = 1;
+    }
+    void appendTransform(std::vector<float>& matrices){
+        float m[16];
+        getTransform(m);
+        matrices.insert(matrices.end(), m, m + 16);
+    }
+    
+    // a sphere around what drawModel() draws, in model space; false if the
+    // object has no useful bound and is always drawn
+    virtual bool getModelBounds(float3& center, float& radius){
+        return false;
+    }
+    // the model bound where draw() puts it; the radius grows with the largest scale
+    bool getWorldBounds(float3& center, float& radius){
+        float3 modelCenter;
+        float modelRadius;
+        if(!getModelBounds(modelCenter, modelRadius))
+            return false;
+        float m[16];
+        getTransform(m);
+        center = float3(m[0]*modelCenter.x + m[4]*modelCenter.y + m[8]*modelCenter.z + m[12],
+                        m[1]*modelCenter.x + m[5]*modelCenter.y + m[9]*modelCenter.z + m[13],
+                        m[2]*modelCenter.x + m[6]*modelCenter.y + m[10]*modelCenter.z + m[14]);
+        float3 s = scaleFactor();
+        radius = modelRadius * std::max(fabsf(s.x), std::max(fabsf(s.y), fabsf(s.z)));
+        return true;
     }
     
     virtual void drawShadow(float3 lightDir){
-        glDisable(GL_TEXTURE_2D);
-        glDisable(GL_LIGHTING);
+        renderState.disable(GL_TEXTURE_2D);
+        renderState.disable(GL_LIGHTING);
         glColor3f(0.1, 0.1, 0.1);
         
-        if(isDead){
+        if(getIsDead()){
             material->apply();
         }
         
@@ -380,106 +707,96 @@ public:
         glTranslatef(1,0,1);
         glScalef(1,.01,1);
         
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        applyTransform();
+        drawModel();
+        glPopMatrix();
+    }
+    // into the shadow map: the model alone, ShadowMap has the state set up
+    virtual void drawDepth(){
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        applyTransform();
         drawModel();
         glPopMatrix();
-        
-        glEnable(GL_TEXTURE_2D);
-        glEnable(GL_LIGHTING);
-        
     }
     
     virtual void draw()
     {
-        if(!isDead){
+        if(!getIsDead()){
+        renderState.enable(GL_LIGHTING);
         material->apply();
         // apply scaling, translation and orientation
         glMatrixMode(GL_MODELVIEW);
         glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        applyTransform();
         drawModel();
         glPopMatrix();
         }
     }
     virtual void drawModel()=0;
     virtual void move(double t, double dt){}
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials, SpatialGrid<Object>& grid)
     {return false;}
     virtual void dead(){}
     
 
 };
 
+std::vector<Object*> Object::nearby;
+float Object::interpolation = 1;
+
 class Bullet : public Object{
-    float3 velocity;
 public:
+    static ObjectPool<Bullet> pool;
+    static void* operator new(size_t){ return pool.allocate(); }
+    static void operator delete(void* p){ pool.release(p); }
+    
     Bullet(Material* m, float o, float3 p) : Object(m){
-        position = p;
+        setKind(EntityStore::Bullet);
+        position() = p;
         float speed = 100;
-        orientationAngle = o;
+        orientationAngle() = o;
         
         float3 ahead;
-        ahead.x = cos(M_PI*(-orientationAngle + 90)/180);
+        ahead.x = cos(M_PI*(-orientationAngle() + 90)/180);
         ahead.y = 0;
-        ahead.z = sin(M_PI*(-orientationAngle + 90)/180);
+        ahead.z = sin(M_PI*(-orientationAngle() + 90)/180);
         
-        velocity = ahead*speed;
+        velocity() = ahead*speed;
 
     }
     
-    virtual void move(double t, double dt){
-        position += velocity*dt;
-    }
-    
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials, SpatialGrid<Object>& grid)
     {
-        for(int i = 0; i < objects.size();i++)
+        nearby.clear();
+        grid.query(position(), 5, nearby);
+        for(int i = 0; i < nearby.size();i++)
         {
-            if(this != objects.at(i) && !objects.at(i)->getIsAvatar() && (position - objects.at(i)->getPosition()).norm() < 5){
-                if(objects.at(i)->getIsEnemy() && !objects.at(i)->getIsDead()){
-                    Object* dead = objects.at(i);
-                    dead->dead();
-                    isDead = true;
+            Object* other = nearby.at(i);
+            if(this != other && !other->getIsAvatar() && (position() - other->getPosition()).norm() < 5){
+                if(other->getIsEnemy() && !other->getIsDead()){
+                    other->dead();
+                    setFlag(EntityStore::Dead);
                 }
-                if(!objects.at(i)->getIsDead() && (objects.at(i)->getIsEnemy() || objects.at(i)->getIsTeapot() || objects.at(i)->getIsHazard())){
-                    isDead = true;
+                if(!other->getIsDead() && (other->getIsEnemy() || other->getIsTeapot() || other->getIsHazard())){
+                    setFlag(EntityStore::Dead);
                 }
             }
         }
         
-        if(position.x > dimension){
-            isDead = true;
-        }
-        if(position.x < -dimension){
-            isDead = true;
-        }
-        if(position.z > dimension){
-            isDead = true;
-        }
-        if(position.z < -dimension){
-            isDead = true;
-        }
-        
         return false;
     }
     
     void draw()
     {
-        glDisable(GL_LIGHTING);
+        renderState.disable(GL_LIGHTING);
         material->apply();
         // apply scaling, translation and orientation
         glMatrixMode(GL_MODELVIEW);
         glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        applyTransform();
         drawModel();
         glPopMatrix();
-        glEnable(GL_LIGHTING);
     }
     
     void drawModel(){
@@ -487,25 +804,62 @@ public:
         
         
     }
+    
+    Mesh* getInstancedMesh(){
+        return bulletSphere;
+    }
+    bool getModelBounds(float3& center, float& radius){
+        center = float3(0, 0, 0);
+        radius = .2;
+        return true;
+    }
+    bool getIsLit(){
+        return false;
+    }
+    bool getIsPooled(){
+        return true;
+    }
 
 };
 
+ObjectPool<Bullet> Bullet::pool;
+
 
 
 
 class MeshInstance : public Object{
 protected:
     Mesh* mesh;
+    unsigned int lod;
 public:
-    MeshInstance(Mesh* me, Material* ma) : mesh(me), Object(ma) {}
+    MeshInstance(Mesh* me, Material* ma) : Object(ma), mesh(me), lod(0) {}
     
     virtual void drawModel(){
-        mesh->draw();
+        mesh->draw(lod);
+    }
+    
+    Mesh* getMesh(){
+        return mesh;
+    }
+    void setLod(unsigned int l){
+        lod = l;
+    }
+    
+    // before the mesh is parsed Mesh::draw shows a unit cube
+    virtual bool getModelBounds(float3& center, float& radius){
+        if(!mesh->isPrepared()){
+            center = float3(0, 0, 0);
+            radius = 0.87;
+            return true;
+        }
+        center = mesh->getBounds().center;
+        radius = mesh->getBounds().radius;
+        return true;
     }
     
     virtual void move(double t, double dt){}
     
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials, SpatialGrid<Object>& grid)
     { return false;}
 
 };
@@ -513,98 +867,80 @@ public:
 class Tree : public MeshInstance{
 public:
     Tree(Mesh* me, Material* ma) : MeshInstance(me, ma) {
-        isHazard = true;
+        setFlag(EntityStore::Hazard);
+    }
+    
+    Mesh* getInstancedMesh(){
+        return mesh;
+    }
+    bool getHasImpostor(){
+        return true;
     }
 };
 
 
 
+// chases the avatar, see EntityStore::steerSeekers
 class Seeker : public MeshInstance{
-    float3 velocity;
-    Object* desired;
 public:
-    Seeker(Mesh* me, Material* ma,Object* d) : MeshInstance(me,ma){
-        isEnemy = true;
-        desired = d;
-    }
+    static ObjectPool<Seeker> pool;
+    static void* operator new(size_t){ return pool.allocate(); }
+    static void operator delete(void* p){ pool.release(p); }
     
-    virtual void move(double t, double dt){
-        velocity = (desired->getPosition() - position).normalize()*score;
-        float3 direction = (desired->getPosition() - position).normalize();
-
-        orientationAngle = ((180*acos(direction.z))/M_PI);
-        if(direction.x < 0)
-            orientationAngle = 360 - orientationAngle;
-        
-        orientationAngle += 90;
-        if(!isDead)
-            position += velocity*dt;
+    Seeker(Mesh* me, Material* ma) : MeshInstance(me,ma){
+        setKind(EntityStore::Seeker);
+        setFlag(EntityStore::Enemy);
     }
     
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects)
-    {
-        if(position.x > dimension){
-            position.x = dimension;
-            velocity.x *= -1;
-        }
-        if(position.x < -dimension){
-            position.x = -dimension;
-            velocity.x *= -1;
-        }
-        if(position.z > dimension){
-            position.z = dimension;
-            velocity.z *= -1;
-        }
-        if(position.z < -dimension){
-            position.z = -dimension;
-            velocity.z *= -1;
-        }
-        
-        return false;
+    virtual void dead(){
+        velocity() = float3(0,0,0);
+        setFlag(EntityStore::Dead);
     }
     
-    virtual void dead(){
-        velocity = float3(0,0,0);
-        isDead = true;
+    Mesh* getInstancedMesh(){
+        return mesh;
+    }
+    bool getHasImpostor(){
+        return true;
+    }
+    bool getIsPooled(){
+        return true;
     }
 };
 
+ObjectPool<Seeker> Seeker::pool;
+
 class Teapot : public Object
 {
 public:
     Teapot(Material* material):Object(material){
-        isTeapot = true;
+        setFlag(EntityStore::Teapot);
     }
     
     void drawModel()
     {
         glutSolidTeapot(1.0f);
     }
-    bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects, std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    // the GLUT teapot reaches about 1.7 from its origin, spout tip included
+    bool getModelBounds(float3& center, float& radius){
+        center = float3(0, 0, 0);
+        radius = 2;
+        return true;
+    }
+    bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects, std::vector<Mesh*>& meshs, std::vector<Material*>& materials, SpatialGrid<Object>& grid)
     {
-        for(int i = 0; i < objects.size();i++)
+        nearby.clear();
+        grid.query(position(), 5, nearby);
+        for(int i = 0; i < nearby.size();i++)
         {
-            if(this != objects.at(i) && !objects.at(i)->getIsEnemy() && (position - objects.at(i)->getPosition()).norm() < 5){
-                position = position.random()*dimension;
-                position.y = 1;
-                if(objects.at(i)->getIsAvatar()){
-                    for(int i = 0; i < score; i++){
-                        Seeker* s = new Seeker(meshs.at(0), materials.at(0),objects.at(0));
-                        s->scale(float3(.2,.2,.2));
-                        float randomPos = float3().random().x*2*dimension - dimension;
-                        float3 spawnPos;
-                        if((score+i)%4 == 0)
-                            spawnPos = float3(dimension,0,randomPos);
-                        else if((score+i)%4 == 1)
-                            spawnPos = float3(-dimension,0,randomPos);
-                        else if((score+i)%4 == 2)
-                            spawnPos = float3(randomPos,0,dimension);
-                        else if((score+i)%4 == 3)
-                            spawnPos = float3(randomPos,0,-dimension);
-                        
-                        s->setPosition(spawnPos);
-                        spawn.push_back(s);
-                    }
+            if(this != nearby.at(i) && !nearby.at(i)->getIsEnemy() && !nearby.at(i)->getIsDead() && (position() - nearby.at(i)->getPosition()).norm() < 5){
+                float3 oldPosition = position();
+                position() = float3::random()*dimension;
+                position().y = 1;
+                savePreviousState();
+                grid.relocate(this, oldPosition);
+                if(nearby.at(i)->getIsAvatar()){
+                    spawnWave(spawn, meshs, materials);
                     score++;
                 }
             }
@@ -613,78 +949,99 @@ public:
         return false;
     }
     
+    // score seekers around the edges of the arena, what picking up the teapot sets loose
+    static void spawnWave(std::vector<Object*>& spawn, std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    {
+        for(int i = 0; i < score; i++){
+            Seeker* s = new Seeker(meshs.at(0), materials.at(0));
+            s->scale(float3(.2,.2,.2));
+            float randomPos = float3().random().x*2*dimension - dimension;
+            float3 spawnPos;
+            if((score+i)%4 == 0)
+                spawnPos = float3(dimension,0,randomPos);
+            else if((score+i)%4 == 1)
+                spawnPos = float3(-dimension,0,randomPos);
+            else if((score+i)%4 == 2)
+                spawnPos = float3(randomPos,0,dimension);
+            else if((score+i)%4 == 3)
+                spawnPos = float3(randomPos,0,-dimension);
+            
+            s->setPosition(spawnPos);
+            spawn.push_back(s);
+        }
+    }
+    
 };
 
 
 class Avatar : public MeshInstance{
-    float3 velocity;
     float acceleration;
     float speed;
-    float angularVelocity;
     float angularAcceleration;
     bool isFiring = false;
 public:
     Avatar(Mesh* me, Material* ma) : MeshInstance(me,ma){
-        isAvatar = true;
-        position = float3(0,1.5,0);
+        setKind(EntityStore::Custom);
+        setFlag(EntityStore::Avatar);
+        position() = float3(0,1.5,0);
         speed = 0;
-        angularVelocity = 0;
+        angularVelocity() = 0;
     }
     
     virtual void move(double t, double dt){
         
         speed += acceleration*dt;
-        orientationAngle += angularVelocity*dt;
+        orientationAngle() += angularVelocity()*dt;
         float3 ahead;
-        ahead.x = cos(M_PI*(-orientationAngle + 90)/180);
+        ahead.x = cos(M_PI*(-orientationAngle() + 90)/180);
         ahead.y = 0;
-        ahead.z = sin(M_PI*(-orientationAngle + 90)/180);
+        ahead.z = sin(M_PI*(-orientationAngle() + 90)/180);
         float3 right = ahead.cross(float3(0, 1, 0)).normalize();
         
-        velocity = ahead*speed;
+        velocity() = ahead*speed;
 
         
-        position += velocity*dt;
-        if(position.y < 0){
-            position.y = 0;
+        position() += velocity()*dt;
+        if(position().y < 0){
+            position().y = 0;
         }
         
-        angularVelocity *= pow(0.4, dt);
+        angularVelocity() *= pow(0.4, dt);
         speed *= pow(0.7, dt);
         
-        if(position.x > dimension){
-            position.x = dimension;
-            velocity.x *= -.1;
+        if(position().x > dimension){
+            position().x = dimension;
+            velocity().x *= -.1;
         }
-        if(position.x < -dimension){
-            position.x = -dimension;
-            velocity.x *= -.1;
+        if(position().x < -dimension){
+            position().x = -dimension;
+            velocity().x *= -.1;
         }
-        if(position.z > dimension){
-            position.z = dimension;
-            velocity.z *= -.1;
+        if(position().z > dimension){
+            position().z = dimension;
+            velocity().z *= -.1;
         }
-        if(position.z < -dimension){
-            position.z = -dimension;
-            velocity.z *= -.1;
+        if(position().z < -dimension){
+            position().z = -dimension;
+            velocity().z *= -.1;
         }
         
     }
     
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
+    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials, SpatialGrid<Object>& grid)
     {
         int SPEED_MAX = 40;
         
         if(keysPressed.at('a'))
-            angularVelocity += 2;
+            angularVelocity() += 2;
         if(keysPressed.at('d'))
-            angularVelocity -= 2;
+            angularVelocity() -= 2;
         if(keysPressed.at('w'))
             acceleration = 20;
         if(keysPressed.at('s'))
             acceleration = -20;
         if(keysPressed.at(' ') && !isFiring){
-            Bullet* b = new Bullet(material,orientationAngle,position);
+            Bullet* b = new Bullet(material,orientationAngle(),position());
             spawn.push_back(b);
             isFiring = true;
         }
@@ -698,19 +1055,21 @@ public:
  
         
         
-        for(int i = 0; i < objects.size(); i++){
-            if(objects.at(i)->getIsHazard() && (position - objects.at(i)->getPosition()).norm() < 5){
+        nearby.clear();
+        grid.query(position(), 5, nearby);
+        for(int i = 0; i < nearby.size(); i++){
+            if(nearby.at(i)->getIsHazard() && (position() - nearby.at(i)->getPosition()).norm() < 5){
                 speed = -speed;
             }
             
-            if(!objects.at(i)->getIsDead() && objects.at(i)->getIsEnemy() && (position - objects.at(i)->getPosition()).norm() < 5){
+            if(!nearby.at(i)->getIsDead() && nearby.at(i)->getIsEnemy() && (position() - nearby.at(i)->getPosition()).norm() < 5){
                 if((speed >= SPEED_MAX || speed <= -SPEED_MAX)){
                     speed = 0;
-                    Object* dead = objects.at(i);
+                    Object* dead = nearby.at(i);
                     dead->dead();
                 }
                 else{
-                    isDead = true;
+                    setFlag(EntityStore::Dead);
                 }
             }
         }
@@ -721,84 +1080,60 @@ public:
     }
 };
 
+// falls and bounces around the arena, see EntityStore::bounceBouncers
 class Bouncer : public MeshInstance{
-    float3 velocity;
-    float angularVelocity;
     float angularAcceleration;
-    float restitution;
 public:
     Bouncer(Mesh* me, Material* ma) : MeshInstance(me,ma){
-        isEnemy = true;
-        position = float3(0,0,0);
-        restitution = 1;
-        angularVelocity = 1;
-        velocity = float3().random()*50;
-        velocity.y = 0;
+        setKind(EntityStore::Bouncer);
+        setFlag(EntityStore::Enemy);
+        position() = float3(0,0,0);
+        angularVelocity() = 1;
+        velocity() = float3().random()*50;
+        velocity().y = 0;
     
     }
-    
-    virtual void move(double t, double dt){
-        position += velocity*dt;
-        velocity += float3(0,-10,0) * dt;
-        orientationAngle += angularVelocity*dt;
-        
-        
-        if(position.y < 0){
-            velocity.y *= -restitution;
-            position.y = 0;
-        }
-        angularVelocity *= pow(0.8, dt);
-        
-    }
-    
-    virtual bool control(std::vector<bool>& keysPressed, std::vector<Object*>& spawn, std::vector<Object*>& objects,std::vector<Mesh*>& meshs, std::vector<Material*>& materials)
-    {
-        
-        if(position.x > dimension){
-            position.x = dimension;
-            velocity.x *= -.5;
-        }
-        if(position.x < -dimension){
-            position.x = -dimension;
-            velocity.x *= -.5;
-        }
-        if(position.z > dimension){
-            position.z = dimension;
-            velocity.z *= -.5;
-        }
-        if(position.z < -dimension){
-            position.z = -dimension;
-            velocity.z *= -.5;
-        }
-
-        
-        return false;
-    }
-    
-
 };
 
 class Ground : public Object{
+    QuadBuffer* quad;
 public:
-    Ground(Material* m) : Object(m){}
+    Ground(Material* m) : Object(m){
+        float3 corners[4] = {
+            float3(-dimension, 0, -dimension), float3(-dimension, 0, dimension),
+            float3(dimension, 0, -dimension), float3(dimension, 0, dimension) };
+        float2 texcoords[4];
+        quad = new QuadBuffer(corners, texcoords);
+    }
+    ~Ground(){
+        delete quad;
+    }
     
     void draw()
     {
-        glDisable(GL_LIGHTING);
+        renderState.disable(GL_LIGHTING);
         glColor3f(0,.8,0);
         material->apply();
+        // the modelview still holds just the camera here, as bindReceiver needs
+        bool shadowed = shadowMap.bindReceiver();
         // apply scaling, translation and orientation
         glMatrixMode(GL_MODELVIEW);
         glPushMatrix();
-        glTranslatef(position.x, position.y, position.z);
-        glRotatef(orientationAngle, orientationAxis.x, orientationAxis.y, orientationAxis.z);
-        glScalef(scaleFactor.x, scaleFactor.y, scaleFactor.z);
+        applyTransform();
         drawModel();
         glPopMatrix();
-        glEnable(GL_LIGHTING);
+        if(shadowed)
+            shadowMap.unbindReceiver();
+    }
+    bool getIsLit(){
+        return false;
     }
     
     void drawModel(){
+        if(useBufferObjects){
+            quad->draw();
+            return;
+        }
         
         glBegin(GL_TRIANGLE_STRIP);
         glVertex4f(-dimension, 0, -dimension, 1);
@@ -812,8 +1147,12 @@ public:
     
     
     virtual void drawShadow(float3 lightDir){}
+    virtual void drawDepth(){}
 };
 
+// how long a dead enemy stays on the ground before it is removed
+const float corpseSeconds = 10;
+
 class Scene
 {
     Camera camera;
@@ -823,36 +1162,193 @@ class Scene
     std::vector<Material*> materials;
     std::vector<Mesh*> meshs;
     std::vector<Billboard*> billboards;
+    // objects drawn on their own, lit ones first, by material, mesh and
+    // then front to back
+    enum RenderPass { LitPass, UnlitPass };
+    RenderQueue<Object> renderQueue;
+    
+    // objects drawn with one instanced call; shadows key on the material only
+    // for corpses, which leave a textured print instead of a grey one. In
+    // the order the render queue sorts by, so batches sharing state follow
+    // each other too.
+    struct BatchKey
+    {
+        Mesh* mesh;
+        unsigned int lod;
+        Material* material;
+        bool lit;
+        bool operator<(const BatchKey& o) const {
+            if(lit != o.lit) return lit > o.lit;
+            if(material != o.material) return std::less<Material*>()(material, o.material);
+            if(mesh != o.mesh) return std::less<Mesh*>()(mesh, o.mesh);
+            return lod < o.lod;
+        }
+    };
+    typedef std::map<BatchKey, std::vector<Object*> > Batches;
+    // collision queries in control(); cells as wide as the 5 unit contact distance
+    SpatialGrid<Object> grid;
+    Batches shadowBatches;
+    Batches batches;
+    Batches casterBatches;              // into the shadow map, keyed on the mesh only
+    std::vector<Object*> casters;       // the same for objects drawn on their own
+    std::vector<float> instanceMatrices;
+    
+    void drawBatches(Batches& b, bool shadows){
+        for(Batches::iterator i = b.begin(); i != b.end(); ++i){
+            std::vector<Object*>& batch = i->second;
+            if(batch.empty())
+                continue;
+            instanceMatrices.clear();
+            for(unsigned int iObject = 0; iObject < batch.size(); iObject++)
+                batch.at(iObject)->appendTransform(instanceMatrices);
+            
+            glMatrixMode(GL_MODELVIEW);
+            glPushMatrix();
+            if(shadows){
+                renderState.disable(GL_TEXTURE_2D);
+                renderState.disable(GL_LIGHTING);
+                glColor3f(0.1, 0.1, 0.1);
+                if(i->first.material)
+                    i->first.material->apply();
+                glTranslatef(1,0,1);
+                glScalef(1,.01,1);
+            }
+            else{
+                if(i->first.lit)
+                    renderState.enable(GL_LIGHTING);
+                else
+                    renderState.disable(GL_LIGHTING);
+                i->first.material->apply();
+            }
+            bool drawn = instanceRenderer.draw(i->first.mesh, instanceMatrices, i->first.lod);
+            glPopMatrix();
+            
+            if(drawn)
+                drawCalls++;
+            else{
+                // mesh still loading: one by one, with its proxy box
+                for(unsigned int iObject = 0; iObject < batch.size(); iObject++){
+                    if(shadows)
+                        batch.at(iObject)->drawShadow(float3(0,1,0));
+                    else
+                        batch.at(iObject)->draw();
+                }
+                drawCalls += batch.size();
+            }
+            batch.clear();
+        }
+    }
+    // the coarsest level of detail whose error, scaled like the object and
+    // seen from the camera at the nearest point of its bound, stays under
+    // lodPixelError pixels
+    unsigned int selectLod(Mesh* mesh, float3 center, float radius){
+        if(lodPixelError <= 0 || mesh->getBounds().radius <= 0)
+            return 0;
+        float scale = radius / mesh->getBounds().radius;
+        float pixelsPerUnit = camera.getPixelsPerUnit((center - camera.getEye()).norm() - radius);
+        unsigned int lod = 0;
+        while(lod + 1 < mesh->getLodCount() && mesh->getLodError(lod + 1) * scale * pixelsPerUnit <= lodPixelError)
+            lod++;
+        return lod;
+    }
+    // rendered the first time it is asked for; NULL if it cannot be
+    ImpostorAtlas* getImpostorAtlas(Mesh* mesh, Material* material){
+        std::pair<Mesh*, Material*> key(mesh, material);
+        ImpostorAtlases::iterator i = impostorAtlases.find(key);
+        if(i != impostorAtlases.end())
+            return i->second->isBuilt() ? i->second : NULL;
+        ImpostorAtlas* atlas = new ImpostorAtlas(mesh->getBounds().center, mesh->getBounds().radius);
+        impostorAtlases[key] = atlas;
+        if(!atlas->begin())
+            return NULL;
+        renderState.enable(GL_LIGHTING);
+        for(unsigned int view = 0; view < ImpostorAtlas::views; view++){
+            atlas->beginView(view);
+            material->apply();
+            mesh->draw();
+        }
+        atlas->end();
+        renderState.invalidate();
+        printf("impostor: %u views of %u triangles\n", ImpostorAtlas::views, mesh->getTriangleCount(0));
+        return atlas;
+    }
+    // how far the object is into the cross-fade to its impostor, 0..1, and the
+    // atlas to draw that from; 0 and no atlas while it is near, or while its
+    // mesh or texture is still loading
+    float selectImpostor(Object* o, float3 center, ImpostorAtlas*& atlas){
+        Mesh* mesh = o->getMesh();
+        if(impostorDistance <= 0 || !mesh || !mesh->isReady() || !o->getMaterial()->isReady())
+            return 0;
+        float distance = (center - camera.getEye()).norm();
+        if(distance <= impostorDistance)
+            return 0;
+        atlas = getImpostorAtlas(mesh, o->getMaterial());
+        if(!atlas)
+            return 0;
+        return std::min(1.0f, (distance - impostorDistance) / impostorFadeBand);
+    }
+    void drawImpostors(){
+        for(ImpostorAtlases::iterator i = impostorAtlases.begin(); i != impostorAtlases.end(); ++i)
+            if(i->second->draw())
+                drawCalls++;
+        renderState.invalidate();
+    }
+    // geometry only, ShadowMap::begin has set up a depth-only pass
+    void drawCasters(){
+        for(Batches::iterator i = casterBatches.begin(); i != casterBatches.end(); ++i){
+            std::vector<Object*>& batch = i->second;
+            if(batch.empty())
+                continue;
+            instanceMatrices.clear();
+            for(unsigned int iObject = 0; iObject < batch.size(); iObject++)
+                batch.at(iObject)->appendTransform(instanceMatrices);
+            if(instanceRenderer.draw(i->first.mesh, instanceMatrices, i->first.lod))
+                drawCalls++;
+            else{
+                for(unsigned int iObject = 0; iObject < batch.size(); iObject++)
+                    batch.at(iObject)->drawDepth();
+                drawCalls += batch.size();
+            }
+            batch.clear();
+        }
+        for(unsigned int iObject = 0; iObject < casters.size(); iObject++)
+            casters.at(iObject)->drawDepth();
+        drawCalls += casters.size();
+        casters.clear();
+    }
 public:
+    Scene():grid(dimension, 5){}
+    
     void initialize()
     {
         newGame = false;
         score = 0;
         restart();
         
-        TexturedMaterial* bullet = new TexturedMaterial("meshpack/bullet2.png");
+        TexturedMaterial* bullet = textureRegistry.acquire("meshpack/bullet2.png");
         
         Billboard* b = new Billboard(bullet);
         billboards.push_back(b);
         
         // BUILD YOUR SCENE HERE
-        Mesh* chevy = new Mesh("meshpack/chevy/chevy.obj");
-        TexturedMaterial* chevySkin = new TexturedMaterial("meshpack/chevy/chevy.png");
+        Mesh* chevy = meshRegistry.acquire("meshpack/chevy/chevy.obj");
+        TexturedMaterial* chevySkin = textureRegistry.acquire("meshpack/chevy/chevy.png");
         
-        Mesh* tigger = new Mesh("meshpack/tigger.obj");
-        TexturedMaterial* tigskin = new TexturedMaterial("meshpack/tigger.png");
+        Mesh* tigger = meshRegistry.acquire("meshpack/tigger.obj");
+        TexturedMaterial* tigskin = textureRegistry.acquire("meshpack/tigger.png");
         
         Avatar* car = new Avatar(chevy, chevySkin);
         car->scale(float3(.25, .25, .25));
         objects.push_back(car);
         
-        Mesh* tree = new Mesh("meshpack/tree/smoothtree.obj");
-        TexturedMaterial* treeskin = new TexturedMaterial("meshpack/tree/tree.png");
+        Mesh* tree = meshRegistry.acquire("meshpack/tree/smoothtree.obj");
+        TexturedMaterial* treeskin = textureRegistry.acquire("meshpack/tree/tree.png");
         
         meshs.push_back(tigger);
         materials.push_back(tigskin);
         meshs.push_back(tree);
         materials.push_back(treeskin);
+        meshs.push_back(chevy);
         
         lightSources.push_back(
                                new DirectionalLight(
@@ -877,8 +1373,15 @@ public:
         materials.push_back(new Material());
         materials.push_back(new Material());
         materials.push_back(new Material());
+        materials.push_back(chevySkin);
+        materials.push_back(bullet);
         
-        
+        // what the last game used and this one does not
+        meshRegistry.purgeUnused();
+        textureRegistry.purgeUnused();
+        printf("assets: meshes %u hits / %u misses / %u resident, textures %u hits / %u misses / %u resident\n",
+               meshRegistry.getHits(), meshRegistry.getMisses(), meshRegistry.getResidentCount(),
+               textureRegistry.getHits(), textureRegistry.getMisses(), textureRegistry.getResidentCount());
         
         /*CREATE ENVIRONMENT*/
         for(int i = 0; i < 10; i++){
@@ -906,90 +1409,139 @@ public:
         Ground* theGround = new Ground(greenDiffuseMaterial);
         objects.push_back(theGround);
         
+        for(int i = 0; i < objects.size(); i++)
+            objects.at(i)->savePreviousState();
+        
         
         
         
     }
+    // resets the game state; meshes and textures go back to the registries
     void restart(){
-        for (int i = 0; i < lightSources.size(); i++){
-            LightSource* ls = lightSources.at(i);
-            lightSources.erase(lightSources.begin() + i);
-            i--;
-            delete ls;
-        }
+        for (int i = 0; i < lightSources.size(); i++)
+            delete lightSources.at(i);
+        lightSources.clear();
         for (int i = 0; i < materials.size(); i++){
-            Material* m = materials.at(i);
-            materials.erase(materials.begin() + i);
-            i--;
-            delete m;
+            if(!textureRegistry.release(materials.at(i)))
+                delete materials.at(i);
         }
+        materials.clear();
+        // bullets and seekers go in one step with their pools and the entity store
         for (int i = 0; i < objects.size(); i++){
-            Object* o = objects.at(i);
-            objects.erase(objects.begin() + i);
-            i--;
-            delete o;
-        }
-        for (int i = 0; i < meshs.size(); i++){
-            Mesh* m = meshs.at(i);
-            meshs.erase(meshs.begin() + i);
-            i--;
-            delete m;
-        }
-        for (int i = 0; i < billboards.size(); i++){
-            Billboard* b = billboards.at(i);
-            billboards.erase(billboards.begin() + i);
-            i--;
-            delete b;
+            if(!objects.at(i)->getIsPooled())
+                delete objects.at(i);
         }
+        objects.clear();
+        entities.clear();
+        Bullet::pool.reset();
+        Seeker::pool.reset();
+        for (int i = 0; i < meshs.size(); i++)
+            meshRegistry.release(meshs.at(i));
+        meshs.clear();
+        for (int i = 0; i < billboards.size(); i++)
+            delete billboards.at(i);
+        billboards.clear();
+        renderQueue.forget();
     }
     
     bool getNewGame(){
         return newGame;
     }
     
-    void move(std::vector<bool> keysPressed, double t, double dt) {
-        Object* avatar = objects.at(0);
-        getCamera().move(avatar->getPosition(),avatar->getOrientation(), dt, keysPressed);
-        billboards.at(0)->setPosition(avatar->getPosition());
-        for(int i=0; i<objects.size(); i++){
-            objects.at(i)->move(t, dt);
+    // for unattended runs: where the live avatar is and which way it faces,
+    // and where the teapot is; false if either is missing
+    bool findAvatarAndTeapot(float3& avatar, float& heading, float3& teapot){
+        bool haveAvatar = false, haveTeapot = false;
+        for(int i = 0; i < objects.size(); i++){
+            Object* o = objects.at(i);
+            if(o->getIsAvatar() && !o->getIsDead()){
+                avatar = o->getPosition();
+                heading = o->getOrientation();
+                haveAvatar = true;
+            }
+            else if(o->getIsTeapot()){
+                teapot = o->getPosition();
+                haveTeapot = true;
+            }
         }
+        return haveAvatar && haveTeapot;
     }
     
-    void control(std::vector<bool> keysPressed) {
+    // for benchmarks: the game as if the teapot had just been picked up at the given score
+    void startAtScore(int level){
+        score = level;
         std::vector<Object*> spawn;
+        Teapot::spawnWave(spawn, meshs, materials);
+        for(int i = 0; i < spawn.size(); i++){
+            spawn.at(i)->savePreviousState();
+            objects.push_back(spawn.at(i));
+        }
+    }
+    
+    // one simulation step of dt
+    void step(std::vector<bool>& keysPressed, double t, double dt) {
+        ProfileZone zone(profiler, "step");
+        entities.savePreviousState();
+        move(keysPressed, t, dt);
+        control(keysPressed);
+    }
+    
+    // objects that move themselves (the avatar) go first, the systems then
+    // walk the entity store: seekers head for where the avatar is now
+    void move(std::vector<bool>& keysPressed, double t, double dt) {
+        ProfileZone zone(profiler, "move");
         for(int i=0; i<objects.size(); i++){
-            objects.at(i)->control(keysPressed, spawn, objects, meshs,materials);
-            if(objects.at(i)->getIsDead() && !objects.at(i)->getIsAvatar() && !objects.at(i)->getIsEnemy()){
-                Object* dead = objects.at(i);
-                objects.erase(objects.begin() + i);
-                i--;
-                delete dead;
-                
-            }
-            
-            if(objects.at(i)->getIsDead() && objects.at(i)->getIsAvatar()){
-                newGame = true;
+            if(entities.kind[objects.at(i)->getEntity()] == EntityStore::Custom)
+                objects.at(i)->move(t, dt);
+        }
+        entities.steerSeekers(objects.at(0)->getPosition(), score, dt);
+        entities.integrateBullets(dt);
+        entities.bounceBouncers(dt, 1);
+        entities.clampToArena(dimension);
+        entities.ageCorpses(dt);
+    }
+    
+    // objects that die during the tick stay in place, flagged, until
+    // removeDead() drops them all at the end of it
+    void control(std::vector<bool>& keysPressed) {
+        ProfileZone zone(profiler, "control");
+        std::vector<Object*> spawn;
+        {
+            ProfileZone collisionZone(profiler, "collision");
+            grid.build(objects);
+            for(int i=0; i<objects.size(); i++){
+                objects.at(i)->control(keysPressed, spawn, objects, meshs,materials, grid);
+                if(objects.at(i)->getIsDead() && objects.at(i)->getIsAvatar()){
+                    newGame = true;
+                }
             }
-
         }
+        removeDead();
         
-        for(int i = 0; i < spawn.size(); i++)
+        for(int i = 0; i < spawn.size(); i++){
+            spawn.at(i)->savePreviousState();
             objects.push_back(spawn.at(i));
+        }
+    }
+    
+    // one pass over objects, the survivors keeping their order; enemies
+    // first lie on the ground as a print for corpseSeconds. The grid is
+    // rebuilt before anything queries it again.
+    void removeDead() {
+        unsigned int kept = 0;
+        for(unsigned int i = 0; i < objects.size(); i++){
+            Object* o = objects.at(i);
+            if(o->getIsDead() && !o->getIsAvatar() && (!o->getIsEnemy() || o->getTimeDead() > corpseSeconds))
+                delete o;
+            else
+                objects.at(kept++) = o;
+        }
+        objects.resize(kept);
     }
     
     ~Scene()
     {
-        for (std::vector<LightSource*>::iterator iLightSource = lightSources.begin(); iLightSource != lightSources.end(); ++iLightSource)
-            delete *iLightSource;
-        for (std::vector<Material*>::iterator iMaterial = materials.begin(); iMaterial != materials.end(); ++iMaterial)
-            delete *iMaterial;
-        for (std::vector<Object*>::iterator iObject = objects.begin(); iObject != objects.end(); ++iObject)
-            delete *iObject;
-        for (std::vector<Mesh*>::iterator iMesh = meshs.begin(); iMesh != meshs.end(); ++iMesh)
-            delete *iMesh;
-        for (std::vector<Billboard*>::iterator iBillboard = billboards.begin(); iBillboard != billboards.end(); ++iBillboard)
-            delete *iBillboard;
+        restart();
     }
     
     
@@ -1000,9 +1552,18 @@ public:
         return camera;
     }
     
-    void draw()
+    // alpha blends each object from its previous simulation state to its current one
+    void draw(float alpha)
     {
+        ProfileZone zone(profiler, "draw");
+        Object::interpolation = alpha;
+        Object* avatar = objects.at(0);
+        camera.follow(avatar->getRenderPosition(), avatar->getRenderOrientation());
+        billboards.at(0)->setPosition(avatar->getRenderPosition());
         camera.apply();
+        // texture uploads since the last frame bound textures of their own
+        renderState.invalidate();
+        renderState.resetCounts();
         unsigned int iLightSource=0;
         for (; iLightSource<lightSources.size(); iLightSource++)
         {
@@ -1012,31 +1573,710 @@ public:
         for (; iLightSource<GL_MAX_LIGHTS; iLightSource++)
             glDisable(GL_LIGHT0 + iLightSource);
         
-        for (unsigned int iObject=0; iObject<objects.size(); iObject++){
-            objects.at(iObject)->drawShadow(float3(0,1,0));
-            objects.at(iObject)->draw();
+        bool instancing = useBufferObjects && instanceRenderer.isAvailable();
+        if(instancing && !bulletSphere){
+            bulletSphere = Mesh::createSphere(.2, 50, 50);
+            bulletSphere->upload();
+        }
+        
+        objectsDrawn = objectsCulled = 0;
+        trianglesFull = trianglesDrawn = 0;
+        impostorsDrawn = 0;
+        float billboardRotation[16];
+        camera.getBillboardRotation(billboardRotation);
+        {
+            ProfileZone shadowZone(profiler, "shadows");
+            gpuTimer.begin("shadows");
+            // with a shadow map live objects only cast into it, corpses still leave a flattened print
+            bool shadowMapping = shadowMap.isAvailable();
+            const Frustum& frustum = camera.getFrustum();
+            float3 focus = avatar->getRenderPosition();
+            float3 lightDir = lightSources.at(0)->getLightDirAt(focus);
+            for (unsigned int iObject=0; iObject<objects.size(); iObject++){
+                Object* o = objects.at(iObject);
+                Mesh* mesh = instancing ? o->getInstancedMesh() : NULL;
+                bool planar = !shadowMapping || o->getIsDead();
+                // the object, its print on the ground (drawShadow's flattening) and its
+                // shadow map footprint are each skipped when they cannot be seen
+                bool visible = true, shadowVisible = true;
+                float3 center;
+                float radius = 0;
+                bool bounded = o->getWorldBounds(center, radius);
+                if(frustumCulling && bounded){
+                    visible = frustum.intersectsSphere(center, radius);
+                    if(planar)
+                        shadowVisible = frustum.intersectsSphere(float3(center.x + 1, center.y * .01, center.z + 1), radius);
+                    else
+                        shadowVisible = shadowMap.mayCast(lightDir, focus, center, radius);
+                }
+                if(bounded && !o->getIsDead()){
+                    if(visible)
+                        objectsDrawn++;
+                    else
+                        objectsCulled++;
+                }
+                // past impostorDistance the mesh fades out under its impostor, and
+                // is no longer drawn once that is opaque
+                ImpostorAtlas* impostor = NULL;
+                float fade = 0;
+                if(visible && bounded && !o->getIsDead() && o->getHasImpostor())
+                    fade = selectImpostor(o, center, impostor);
+                if(impostor){
+                    impostor->add(billboardRotation, camera.getEye(), center, radius, o->getRenderOrientation(), fade);
+                    impostorsDrawn++;
+                }
+                bool meshVisible = visible && fade < 1;
+                unsigned int lod = 0;
+                Mesh* lodMesh = o->getMesh();
+                if(lodMesh && lodMesh->isPrepared()){
+                    if(bounded)
+                        lod = selectLod(lodMesh, center, radius);
+                    if(visible && !o->getIsDead()){
+                        trianglesFull += lodMesh->getTriangleCount(0);
+                        if(meshVisible)
+                            trianglesDrawn += lodMesh->getTriangleCount(std::min(lod, lodMesh->getLodCount() - 1));
+                        if(impostor)
+                            trianglesDrawn += 2;
+                    }
+                }
+                o->setLod(lod);
+                if(!mesh){
+                    if(shadowVisible && planar){
+                        o->drawShadow(float3(0,1,0));
+                        drawCalls++;
+                    }
+                    else if(shadowVisible)
+                        casters.push_back(o);
+                    if(meshVisible)
+                        renderQueue.push(o->getIsLit() ? LitPass : UnlitPass, o->getMaterial(), o->getMesh(),
+                                         bounded ? (center - camera.getEye()).norm() : 0, false, o);
+                    continue;
+                }
+                if(shadowVisible && planar){
+                    BatchKey shadowKey = { mesh, lod, o->getIsDead() ? o->getMaterial() : NULL, false };
+                    shadowBatches[shadowKey].push_back(o);
+                }
+                else if(shadowVisible){
+                    BatchKey casterKey = { mesh, lod, NULL, false };
+                    casterBatches[casterKey].push_back(o);
+                }
+                if(meshVisible && !o->getIsDead()){
+                    BatchKey key = { mesh, lod, o->getMaterial(), o->getIsLit() };
+                    batches[key].push_back(o);
+                }
+            }
+            if(shadowMapping && shadowMap.begin(lightDir, focus)){
+                drawCasters();
+                shadowMap.end();
+                renderState.invalidate();
+            }
+            drawBatches(shadowBatches, true);
+            gpuTimer.end();
+        }
+        
+        {
+            ProfileZone objectZone(profiler, "objects");
+            gpuTimer.begin("objects");
+            renderQueue.sort();
+            for (unsigned int iObject=0; iObject<renderQueue.size(); iObject++){
+                renderQueue.at(iObject)->draw();
+                drawCalls++;
+            }
+            renderQueue.clear();
+            drawBatches(batches, false);
+            // over the meshes they fade in on
+            drawImpostors();
+            gpuTimer.end();
         }
+        ProfileZone billboardZone(profiler, "billboards");
+        gpuTimer.begin("billboards");
         for (unsigned int iBillboard=0; iBillboard<billboards.size(); iBillboard++){
             billboards.at(iBillboard)->draw(this->getCamera());
         }
+        gpuTimer.end();
     }
 };
 
 Scene scene;
 std::vector<bool> keysPressed;
 
+// The simulation runs in fixed steps whatever the frame rate; frames draw
+// between the last two steps. After a stall at most maxStepsPerFrame steps
+// are caught up and the rest of the time is dropped, so a slow frame slows
+// the game down instead of making the next frame slower still.
+const double stepSeconds = 1.0 / 120;
+const int maxStepsPerFrame = 8;
+double renderAlpha = 1;
+
+// Input scripts for --headless, one key change per line: "<tick> down|up <key>",
+// the key a character or "space". --record writes the same format from play.
+struct InputEvent
+{
+    unsigned long tick;
+    unsigned char key;
+    bool down;
+};
+unsigned long simulationTick = 0;   // simulation steps taken
+FILE* inputRecord = NULL;
+
+void recordInput(unsigned char key, bool down)
+{
+    if(!inputRecord || keysPressed.at(key) == down)
+        return;
+    if(key == ' ')
+        fprintf(inputRecord, "%lu %s space\n", simulationTick, down ? "down" : "up");
+    else
+        fprintf(inputRecord, "%lu %s %c\n", simulationTick, down ? "down" : "up", key);
+}
+
+bool loadInputScript(const char* path, std::vector<InputEvent>& events)
+{
+    FILE* f = fopen(path, "r");
+    if(!f)
+        return false;
+    char line[256];
+    while(fgets(line, sizeof(line), f)){
+        InputEvent e;
+        char state[16], key[16];
+        if(line[0] == '#' || sscanf(line, "%lu %15s %15s", &e.tick, state, key) != 3)
+            continue;
+        e.down = strcmp(state, "down") == 0;
+        e.key = strcmp(key, "space") == 0 ? ' ' : key[0];
+        events.push_back(e);
+    }
+    fclose(f);
+    return true;
+}
+
+// without a script: drive for the teapot, so waves of seekers get set loose,
+// and fire 4 times a second while it is not ahead (a bullet would move it)
+void defaultInput(unsigned long tick, double dt, std::vector<bool>& keys)
+{
+    double t = tick * dt;
+    keys.at('w') = true;
+    keys.at('a') = false;
+    keys.at('d') = false;
+    bool teapotAhead = false;
+    float3 avatar, teapot;
+    float heading = 0;
+    if(scene.findAvatarAndTeapot(avatar, heading, teapot)){
+        // the avatar faces (sin, 0, cos) of its heading, 'a' turns it towards larger angles
+        float3 toTeapot = teapot - avatar;
+        float turn = atan2f(toTeapot.x, toTeapot.z) * 180 / M_PI - heading;
+        turn = fmodf(turn, 360);
+        if(turn > 180)
+            turn -= 360;
+        if(turn < -180)
+            turn += 360;
+        keys.at('a') = turn > 5;
+        keys.at('d') = turn < -5;
+        // slow down to turn rather than circle it
+        keys.at('w') = fabsf(turn) < 60;
+        teapotAhead = fabsf(turn) < 30;
+    }
+    keys.at(' ') = !teapotAhead && fmod(t, 0.25) < 0.05;
+}
+
+// pool use so far; once the chunks cover the peak population, spawning no
+// longer reaches the global allocator
+void reportPools()
+{
+    printf("pools: bullets %lu allocated, peak %u live in %u chunk(s); seekers %lu allocated, peak %u live in %u chunk(s)\n",
+           Bullet::pool.getAllocations(), Bullet::pool.getHighWater(), Bullet::pool.getChunks(),
+           Seeker::pool.getAllocations(), Seeker::pool.getHighWater(), Seeker::pool.getChunks());
+}
+
+// Steps the scene at a fixed dt with no window, for benchmarks and batch runs.
+// ./3DGame --headless [--ticks n] [--dt seconds] [--seed n] [--input script]
+int runHeadless(int argc, char **argv)
+{
+    unsigned long ticks = 36000;
+    double dt = stepSeconds;
+    unsigned int seed = 1;
+    const char* inputPath = NULL;
+    for(int i = 1; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--ticks") == 0)
+            ticks = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--dt") == 0)
+            dt = atof(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0)
+            seed = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--input") == 0)
+            inputPath = argv[++i];
+        else if(strcmp(argv[i], "--trace") == 0)
+            tracePath = argv[++i];
+    }
+    std::vector<InputEvent> events;
+    if(inputPath && !loadInputScript(inputPath, events)){
+        printf("headless: cannot read %s\n", inputPath);
+        return 1;
+    }
+    
+    srand(seed);
+    for(int i=0; i<256; i++)
+        keysPressed.push_back(false);
+    scene.initialize();
+    // nothing is drawn, but let the loading threads finish before timing
+    assetLoader.discardUploads();
+    
+    if(tracePath)
+        profiler.startTrace();
+    unsigned int games = 1;
+    int bestScore = 0;
+    unsigned int nextEvent = 0;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for(simulationTick = 0; simulationTick < ticks; simulationTick++){
+        if(inputPath){
+            for(; nextEvent < events.size() && events[nextEvent].tick <= simulationTick; nextEvent++)
+                keysPressed.at(events[nextEvent].key) = events[nextEvent].down;
+        }
+        else
+            defaultInput(simulationTick, dt, keysPressed);
+        scene.step(keysPressed, simulationTick * dt, dt);
+        profiler.endFrame();
+        bestScore = std::max(bestScore, score);
+        if(scene.getNewGame()){
+            scene.initialize();
+            games++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("headless: %lu ticks of %.4f s in %.2f s, %.0f ticks/s, %u games, best score %d\n",
+           ticks, dt, seconds, ticks / seconds, games, bestScore);
+    reportPools();
+    std::vector<Profiler::Stats> stats;
+    profiler.getStats(stats);
+    for(unsigned int i = 0; i < stats.size(); i++)
+        printf("%*s%s: min %.4f, avg %.4f, p99 %.4f ms/tick over the last 300 ticks\n", 2 * stats[i].depth, "",
+               stats[i].name, stats[i].minMs, stats[i].averageMs, stats[i].p99Ms);
+    if(tracePath)
+        profiler.writeTrace(tracePath);
+    return 0;
+}
+
+
+// Gameplay benchmark: the same input (a recorded script, or defaultInput)
+// replayed from the same seed at escalating score levels, each level
+// starting as if the teapot had just been picked up at that score. Times
+// the simulation and, with a window, the drawing of every tick (glFinish
+// included), and writes one CSV line per level. Given a baseline CSV from
+// an earlier run, levels that got slower by more than 15% are reported and
+// the exit status is 1.
+// ./3DGame --bench-gameplay [--input script] [--seed n] [--ticks n] [--out file] [--baseline file] [--no-render]
+//                           [--no-cull] [--lod-error px] [--impostor-distance d] [--no-state-cache]
+struct GameplayLevel
+{
+    int score;
+    std::vector<double> simulationMs;
+    std::vector<double> renderMs;
+    unsigned int peakSeekers;
+    unsigned int peakObjects;
+    unsigned long glDrawCalls;
+    unsigned long objectsDrawn;
+    unsigned long objectsCulled;
+    unsigned long trianglesFull;
+    unsigned long trianglesDrawn;
+    unsigned long impostorsDrawn;
+    unsigned long stateCallsSkipped;
+    unsigned int games;
+};
+
+struct GameplayBenchmark
+{
+    std::vector<InputEvent> events;
+    bool scripted;
+    unsigned int seed;
+    unsigned long ticks;
+    bool render;
+    const char* outPath;
+    const char* baselinePath;
+    
+    std::vector<GameplayLevel> levels;
+    unsigned int level;
+    unsigned long tick;
+    unsigned int nextEvent;
+    
+    GameplayBenchmark():scripted(false),seed(1),ticks(3600),render(true),outPath("gameplay.csv"),baselinePath(NULL),
+        level(0),tick(0),nextEvent(0){
+        const int scores[] = { 1, 10, 40, 160 };
+        for(unsigned int i = 0; i < sizeof(scores) / sizeof(scores[0]); i++){
+            GameplayLevel l;
+            l.score = scores[i];
+            l.peakSeekers = l.peakObjects = 0;
+            l.glDrawCalls = 0;
+            l.objectsDrawn = l.objectsCulled = 0;
+            l.trianglesFull = l.trianglesDrawn = 0;
+            l.impostorsDrawn = 0;
+            l.stateCallsSkipped = 0;
+            l.games = 0;
+            levels.push_back(l);
+        }
+    }
+    
+    void startGame(){
+        scene.initialize();
+        // everything resident before the clock starts
+        if(render){
+            while(!assetLoader.isIdle())
+                assetLoader.drainUploads(1e9);
+        }
+        else
+            assetLoader.discardUploads();
+        scene.startAtScore(levels[level].score);
+        levels[level].games++;
+    }
+    
+    void startLevel(){
+        srand(seed);
+        for(unsigned int i = 0; i < keysPressed.size(); i++)
+            keysPressed[i] = false;
+        tick = 0;
+        nextEvent = 0;
+        startGame();
+    }
+    
+    // one tick of the current level; false once every level has run
+    bool step(){
+        if(level == levels.size())
+            return false;
+        if(tick == 0 && levels[level].games == 0)
+            startLevel();
+        GameplayLevel& l = levels[level];
+        if(scripted){
+            for(; nextEvent < events.size() && events[nextEvent].tick <= tick; nextEvent++)
+                keysPressed.at(events[nextEvent].key) = events[nextEvent].down;
+        }
+        else
+            defaultInput(tick, stepSeconds, keysPressed);
+        
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        scene.step(keysPressed, tick * stepSeconds, stepSeconds);
+        std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+        l.simulationMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        unsigned int seekers = 0;
+        for(unsigned int e = 0; e < entities.size(); e++)
+            seekers += entities.kind[e] == EntityStore::Seeker;
+        l.peakSeekers = std::max(l.peakSeekers, seekers);
+        l.peakObjects = std::max(l.peakObjects, entities.size());
+        if(scene.getNewGame())
+            startGame();
+        
+        if(render){
+            glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glStats().reset();
+            t0 = std::chrono::high_resolution_clock::now();
+            scene.draw(1);
+            glFinish();
+            t1 = std::chrono::high_resolution_clock::now();
+            l.renderMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+            l.glDrawCalls += glStats().drawCalls;
+            l.objectsDrawn += objectsDrawn;
+            l.objectsCulled += objectsCulled;
+            l.trianglesFull += trianglesFull;
+            l.trianglesDrawn += trianglesDrawn;
+            l.impostorsDrawn += impostorsDrawn;
+            l.stateCallsSkipped += renderState.getSkipped();
+        }
+        
+        if(++tick == ticks){
+            level++;
+            tick = 0;
+        }
+        return true;
+    }
+    
+    static double average(const std::vector<double>& v){
+        double sum = 0;
+        for(unsigned int i = 0; i < v.size(); i++)
+            sum += v[i];
+        return v.empty() ? 0 : sum / v.size();
+    }
+    static double percentile99(std::vector<double> v){
+        if(v.empty())
+            return 0;
+        std::sort(v.begin(), v.end());
+        return v[(v.size() - 1) * 99 / 100];
+    }
+    
+    // simulation and render averages per score from an earlier --out file
+    static std::map<int, std::pair<double, double> > readBaseline(const char* path){
+        std::map<int, std::pair<double, double> > baseline;
+        FILE* f = fopen(path, "r");
+        if(!f)
+            return baseline;
+        char line[512];
+        int score;
+        unsigned long ticks;
+        unsigned int seekers, objects;
+        double simulationAverage, simulationP99, renderAverage;
+        while(fgets(line, sizeof(line), f)){
+            if(sscanf(line, "%d,%lu,%u,%u,%lf,%lf,%lf", &score, &ticks, &seekers, &objects,
+                      &simulationAverage, &simulationP99, &renderAverage) == 7)
+                baseline[score] = std::make_pair(simulationAverage, renderAverage);
+        }
+        fclose(f);
+        return baseline;
+    }
+    
+    // prints and writes the results; 1 if a level regressed against the baseline
+    int report(){
+        FILE* out = fopen(outPath, "w");
+        if(out)
+            fprintf(out, "score,ticks,peak_seekers,peak_objects,sim_avg_ms,sim_p99_ms,render_avg_ms,render_p99_ms,draw_calls_per_tick,games,"
+                    "objects_drawn_per_tick,objects_culled_per_tick,triangles_full_per_tick,triangles_drawn_per_tick,impostors_per_tick,"
+                    "state_calls_skipped_per_tick\n");
+        std::map<int, std::pair<double, double> > baseline;
+        if(baselinePath)
+            baseline = readBaseline(baselinePath);
+        int regressions = 0;
+        for(unsigned int i = 0; i < levels.size(); i++){
+            GameplayLevel& l = levels[i];
+            double simulationAverage = average(l.simulationMs), renderAverage = average(l.renderMs);
+            double drawCalls = l.renderMs.empty() ? 0 : (double)l.glDrawCalls / l.renderMs.size();
+            double drawn = l.renderMs.empty() ? 0 : (double)l.objectsDrawn / l.renderMs.size();
+            double culled = l.renderMs.empty() ? 0 : (double)l.objectsCulled / l.renderMs.size();
+            double fullTriangles = l.renderMs.empty() ? 0 : (double)l.trianglesFull / l.renderMs.size();
+            double drawnTriangles = l.renderMs.empty() ? 0 : (double)l.trianglesDrawn / l.renderMs.size();
+            double impostors = l.renderMs.empty() ? 0 : (double)l.impostorsDrawn / l.renderMs.size();
+            double skipped = l.renderMs.empty() ? 0 : (double)l.stateCallsSkipped / l.renderMs.size();
+            printf("score %3d: %lu ticks, peak %u seekers / %u objects, %u games, simulation %.4f avg %.4f p99 ms",
+                   l.score, ticks, l.peakSeekers, l.peakObjects, l.games, simulationAverage, percentile99(l.simulationMs));
+            if(render)
+                printf(", render %.3f avg %.3f p99 ms, %.0f draw calls, %.0f objects drawn / %.0f culled, %.0f of %.0f triangles, %.0f impostors, %.0f state calls skipped",
+                       renderAverage, percentile99(l.renderMs), drawCalls, drawn, culled, drawnTriangles, fullTriangles, impostors, skipped);
+            printf("\n");
+            if(out)
+                fprintf(out, "%d,%lu,%u,%u,%.5f,%.5f,%.5f,%.5f,%.1f,%u,%.1f,%.1f,%.0f,%.0f,%.1f,%.1f\n", l.score, ticks, l.peakSeekers, l.peakObjects,
+                        simulationAverage, percentile99(l.simulationMs), renderAverage, percentile99(l.renderMs),
+                        drawCalls, l.games, drawn, culled, fullTriangles, drawnTriangles, impostors, skipped);
+            std::map<int, std::pair<double, double> >::iterator b = baseline.find(l.score);
+            if(b == baseline.end())
+                continue;
+            if(simulationAverage > b->second.first * 1.15){
+                printf("    REGRESSION: simulation %.4f ms, baseline %.4f ms\n", simulationAverage, b->second.first);
+                regressions++;
+            }
+            if(render && b->second.second > 0 && renderAverage > b->second.second * 1.15){
+                printf("    REGRESSION: render %.3f ms, baseline %.3f ms\n", renderAverage, b->second.second);
+                regressions++;
+            }
+        }
+        if(out){
+            fclose(out);
+            printf("gameplay: results written to %s\n", outPath);
+        }
+        return regressions ? 1 : 0;
+    }
+};
+
+GameplayBenchmark gameplay;
+
+// one tick per frame while the benchmark draws
+void onBenchmarkDisplay()
+{
+    if(!gameplay.step())
+        exit(gameplay.report());
+    glutSwapBuffers();
+    glutPostRedisplay();
+}
+
+// sets the benchmark up from the command line; true if it runs in a window
+bool setUpGameplayBenchmark(int argc, char **argv)
+{
+    const char* inputPath = NULL;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--no-render") == 0)
+            gameplay.render = false;
+        if(strcmp(argv[i], "--no-cull") == 0)
+            frustumCulling = false;
+        if(strcmp(argv[i], "--no-state-cache") == 0)
+            renderState.setEnabled(false);
+        if(i + 1 == argc)
+            continue;
+        if(strcmp(argv[i], "--input") == 0)
+            inputPath = argv[++i];
+        else if(strcmp(argv[i], "--seed") == 0)
+            gameplay.seed = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--ticks") == 0)
+            gameplay.ticks = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--out") == 0)
+            gameplay.outPath = argv[++i];
+        else if(strcmp(argv[i], "--baseline") == 0)
+            gameplay.baselinePath = argv[++i];
+        else if(strcmp(argv[i], "--lod-error") == 0)
+            lodPixelError = atof(argv[++i]);
+        else if(strcmp(argv[i], "--impostor-distance") == 0)
+            impostorDistance = atof(argv[++i]);
+    }
+    if(inputPath && !loadInputScript(inputPath, gameplay.events)){
+        printf("gameplay: cannot read %s\n", inputPath);
+        exit(1);
+    }
+    gameplay.scripted = inputPath != NULL;
+#ifdef HEADLESS
+    gameplay.render = false;
+#endif
+    for(int i=0; i<256; i++)
+        keysPressed.push_back(false);
+    return gameplay.render;
+}
+
+
+// average frame time and draw calls, printed every few hundred frames to compare render paths
+void reportFrameTime()
+{
+    static std::chrono::high_resolution_clock::time_point last = std::chrono::high_resolution_clock::now();
+    static int frames = 0;
+    static unsigned int totalDrawCalls = 0;
+    static unsigned int totalDrawn = 0, totalCulled = 0;
+    static unsigned long totalTrianglesFull = 0, totalTrianglesDrawn = 0;
+    static unsigned int totalImpostors = 0;
+    static unsigned long totalSkipped = 0;
+    totalDrawCalls += drawCalls;
+    totalDrawn += objectsDrawn;
+    totalCulled += objectsCulled;
+    totalTrianglesFull += trianglesFull;
+    totalTrianglesDrawn += trianglesDrawn;
+    totalImpostors += impostorsDrawn;
+    totalSkipped += renderState.getSkipped();
+    drawCalls = 0;
+    if(++frames < 300)
+        return;
+    std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+    printf("%.2f ms/frame, %.1f draw calls/frame, %.1f objects drawn / %.1f culled, %.0f of %.0f triangles, %.1f impostors, %.1f state calls skipped (%s)\n",
+           std::chrono::duration<double, std::milli>(now - last).count() / frames, (double)totalDrawCalls / frames,
+           (double)totalDrawn / frames, (double)totalCulled / frames, (double)totalTrianglesDrawn / frames,
+           (double)totalTrianglesFull / frames, (double)totalImpostors / frames, (double)totalSkipped / frames, useBufferObjects ? "buffer objects" : "legacy display lists");
+    last = now;
+    frames = 0;
+    totalDrawCalls = 0;
+    totalDrawn = totalCulled = 0;
+    totalTrianglesFull = totalTrianglesDrawn = 0;
+    totalImpostors = 0;
+    totalSkipped = 0;
+}
+
+// rolling zone times in the top left corner, in a fixed-width font so the columns line up
+void drawProfileOverlay()
+{
+    std::vector<Profiler::Stats> stats;
+    profiler.getStats(stats);
+    GLint viewport[4] = { 0, 0, 0, 0 };
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, viewport[2], 0, viewport[3]);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    renderState.disable(GL_LIGHTING);
+    glColor3f(1, 1, 1);
+    char line[80];
+    float y = viewport[3] - 20;
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, "ms              min    avg    p99");
+    for(unsigned int i = 0; i < stats.size(); i++){
+        y -= 15;
+        snprintf(line, sizeof(line), "%*s%-*s %6.2f %6.2f %6.2f", 2 * stats[i].depth, "", 14 - 2 * stats[i].depth,
+                 stats[i].name, stats[i].minMs, stats[i].averageMs, stats[i].p99Ms);
+        renderState.disable(GL_LIGHTING);
+        renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    }
+    for(unsigned int i = 0; i < gpuTimer.getPassCount(); i++){
+        y -= 15;
+        snprintf(line, sizeof(line), "gpu %-10s %6.2f", gpuTimer.getPassName(i), gpuTimer.getPassMs(i));
+        renderState.disable(GL_LIGHTING);
+        renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    }
+    y -= 15;
+    snprintf(line, sizeof(line), "%lu draws, %lu vertices", lastFrameGL.drawCalls, lastFrameGL.vertices);
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    y -= 15;
+    snprintf(line, sizeof(line), "%lu enable, %lu material, %lu texture", lastFrameGL.capabilityChanges,
+             lastFrameGL.materialChanges, lastFrameGL.textureBinds);
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    y -= 15;
+    snprintf(line, sizeof(line), "%u objects drawn, %u culled", objectsDrawn, objectsCulled);
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    y -= 15;
+    snprintf(line, sizeof(line), "%lu of %lu triangles (lod)", trianglesDrawn, trianglesFull);
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    y -= 15;
+    snprintf(line, sizeof(line), "%u impostors", impostorsDrawn);
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    y -= 15;
+    snprintf(line, sizeof(line), "%lu state calls, %lu skipped", renderState.getIssued(), renderState.getSkipped());
+    renderState.disable(GL_LIGHTING);
+    renderBitmapString(10, y, 0, GLUT_BITMAP_8_BY_13, line);
+    glEnable(GL_DEPTH_TEST);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// frame, CPU ms in onDisplay, GPU ms per pass (as of a few frames back), then the GL counts
+void logFrameStats(double cpuMs)
+{
+    static unsigned long frame = 0;
+    if(frame == 0){
+        fprintf(glStatsLog, "frame,cpu_ms");
+        for(unsigned int i = 0; i < gpuTimer.getPassCount(); i++)
+            fprintf(glStatsLog, ",gpu_%s_ms", gpuTimer.getPassName(i));
+        fprintf(glStatsLog, ",draw_calls,vertices,enable_disable,material,texture_binds,objects_drawn,objects_culled,"
+                "triangles_full,triangles_drawn,impostors,state_calls,state_calls_skipped\n");
+    }
+    fprintf(glStatsLog, "%lu,%.3f", frame++, cpuMs);
+    for(unsigned int i = 0; i < gpuTimer.getPassCount(); i++)
+        fprintf(glStatsLog, ",%.3f", gpuTimer.getPassMs(i));
+    fprintf(glStatsLog, ",%lu,%lu,%lu,%lu,%lu,%u,%u,%lu,%lu,%u,%lu,%lu\n", lastFrameGL.drawCalls, lastFrameGL.vertices,
+            lastFrameGL.capabilityChanges, lastFrameGL.materialChanges, lastFrameGL.textureBinds, objectsDrawn, objectsCulled,
+            trianglesFull, trianglesDrawn, impostorsDrawn, renderState.getIssued(), renderState.getSkipped());
+}
+
+void writeTrace()
+{
+    profiler.writeTrace(tracePath);
+}
 
 void onDisplay( ) {
     glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear screen
     
     
-    if(scene.getNewGame())
+    if(scene.getNewGame()){
+        reportPools();
         scene.initialize();
-    scene.draw();
-    sc.draw(scene.getCamera());
+    }
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    {
+        ProfileZone zone(profiler, "display");
+        assetLoader.drainUploads(uploadBudgetMs);
+        scene.draw(renderAlpha);
+        ProfileZone hudZone(profiler, "hud");
+        gpuTimer.begin("hud");
+        sc.draw(scene.getCamera());
+        if(showProfile)
+            drawProfileOverlay();
+        gpuTimer.end();
+    }
+    double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
     
     glutSwapBuffers(); // drawing finished
+    profiler.endFrame();
+    gpuTimer.endFrame();
+    lastFrameGL = glStats();
+    glStats().reset();
+    if(glStatsLog)
+        logFrameStats(cpuMs);
+    reportFrameTime();
 }
 
 
@@ -1045,23 +2285,37 @@ void onIdle()
 {
     double t = glutGet(GLUT_ELAPSED_TIME) * 0.001;        	// time elapsed since starting this program in msec
     static double lastTime = 0.0;
-    double dt = t - lastTime;
+    static double accumulator = 0.0;
+    accumulator += t - lastTime;
     lastTime = t;
     
-    
-    scene.move(keysPressed,t,dt);
-    scene.control(keysPressed);
+    int steps = 0;
+    while(accumulator >= stepSeconds && !scene.getNewGame()){
+        if(steps == maxStepsPerFrame){
+            accumulator = 0;
+            break;
+        }
+        scene.step(keysPressed, simulationTick * stepSeconds, stepSeconds);
+        simulationTick++;
+        accumulator -= stepSeconds;
+        steps++;
+    }
+    renderAlpha = std::min(accumulator / stepSeconds, 1.0);
     
     glutPostRedisplay();
 }
 
 void onKeyboard(unsigned char key, int x, int y)
 {
+    if(key == 'p')
+        showProfile = !showProfile;
+    recordInput(key, true);
     keysPressed.at(key) = true;
 }
 
 void onKeyboardUp(unsigned char key, int x, int y)
 {
+    recordInput(key, false);
     keysPressed.at(key) = false;
 }
 
@@ -1083,9 +2337,361 @@ void onReshape(int winWidth, int winHeight)
 {
     glViewport(0, 0, winWidth, winHeight);
     scene.getCamera().setAspectRatio((float)winWidth/winHeight);
+    scene.getCamera().setViewportHeight(winHeight);
 }	
 
+// stand-in for Object in --bench-collision, only what SpatialGrid needs
+struct CollisionProbe
+{
+    float3 position;
+    float3 getPosition(){ return position; }
+};
+
+// One tick of contact tests for count objects spread over the arena: every
+// object against every other, as control() used to do, versus a grid rebuild
+// plus one query each. The brute force pass is timed on a sample and scaled.
+void benchmarkCollision(int count)
+{
+    std::vector<CollisionProbe> probes(count);
+    std::vector<CollisionProbe*> pointers(count);
+    for(int i = 0; i < count; i++){
+        float3 r = float3::random();
+        probes[i].position = float3(r.x * 2 * dimension - dimension, 0, r.z * 2 * dimension - dimension);
+        pointers[i] = &probes[i];
+    }
+    int sample = std::min(count, 1000);
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    long bruteContacts = 0;
+    for(int i = 0; i < sample; i++)
+        for(int j = 0; j < count; j++)
+            if(i != j && (probes[i].position - probes[j].position).norm() < 5)
+                bruteContacts++;
+    double bruteMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+        * count / sample;
+    
+    SpatialGrid<CollisionProbe> grid(dimension, 5);
+    std::vector<CollisionProbe*> candidates;
+    long gridContacts = 0, sampleContacts = 0;
+    start = std::chrono::high_resolution_clock::now();
+    grid.build(pointers);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    for(int i = 0; i < count; i++){
+        candidates.clear();
+        grid.query(probes[i].position, 5, candidates);
+        for(unsigned int j = 0; j < candidates.size(); j++)
+            if(candidates[j] != &probes[i] && (probes[i].position - candidates[j]->position).norm() < 5)
+                gridContacts++;
+        if(i == sample - 1)
+            sampleContacts = gridContacts;
+    }
+    double gridMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    printf("%d objects: brute force %.2f ms/tick (from %d), grid %.2f ms/tick (build %.2f ms), %.0fx, %ld contacts%s\n",
+           count, bruteMs, sample, gridMs, buildMs, bruteMs / gridMs, gridContacts,
+           sampleContacts == bruteContacts ? "" : ", MISMATCH");
+}
+
+// The layout the entity store replaced, kept for --bench-entities: every
+// object on the heap with its own state, moved by a virtual call.
+struct LegacyEntity
+{
+    void* material;
+    float3 scaleFactor;
+    float3 position;
+    float3 orientationAxis;
+    float orientationAngle;
+    bool isDead, isHazard, isEnemy, isTeapot, isAvatar;
+    float3 velocity;
+    float angularVelocity;
+    
+    LegacyEntity():material(NULL),orientationAngle(0),isDead(false),isHazard(false),isEnemy(false),isTeapot(false),isAvatar(false),angularVelocity(0){}
+    virtual ~LegacyEntity(){}
+    virtual void move(float3 target, float speed, double dt)=0;
+    virtual void control(float halfExtent){}
+};
+
+struct LegacySeeker : public LegacyEntity
+{
+    void move(float3 target, float speed, double dt){
+        velocity = (target - position).normalize()*speed;
+        float3 direction = (target - position).normalize();
+        orientationAngle = ((180*acos(direction.z))/M_PI);
+        if(direction.x < 0)
+            orientationAngle = 360 - orientationAngle;
+        orientationAngle += 90;
+        if(!isDead)
+            position += velocity*dt;
+    }
+    void control(float halfExtent){
+        if(position.x > halfExtent){ position.x = halfExtent; velocity.x *= -1; }
+        if(position.x < -halfExtent){ position.x = -halfExtent; velocity.x *= -1; }
+        if(position.z > halfExtent){ position.z = halfExtent; velocity.z *= -1; }
+        if(position.z < -halfExtent){ position.z = -halfExtent; velocity.z *= -1; }
+    }
+};
+
+struct LegacyBullet : public LegacyEntity
+{
+    void move(float3 target, float speed, double dt){
+        position += velocity*dt;
+    }
+    void control(float halfExtent){
+        if(position.x > halfExtent || position.x < -halfExtent || position.z > halfExtent || position.z < -halfExtent)
+            isDead = true;
+    }
+};
+
+struct LegacyBouncer : public LegacyEntity
+{
+    void move(float3 target, float speed, double dt){
+        position += velocity*dt;
+        velocity += float3(0,-10,0) * dt;
+        orientationAngle += angularVelocity*dt;
+        if(position.y < 0){
+            velocity.y *= -1;
+            position.y = 0;
+        }
+        angularVelocity *= pow(0.8, dt);
+    }
+    void control(float halfExtent){
+        if(position.x > halfExtent){ position.x = halfExtent; velocity.x *= -.5; }
+        if(position.x < -halfExtent){ position.x = -halfExtent; velocity.x *= -.5; }
+        if(position.z > halfExtent){ position.z = halfExtent; velocity.z *= -.5; }
+        if(position.z < -halfExtent){ position.z = -halfExtent; velocity.z *= -.5; }
+    }
+};
+
+// Per-tick move + bounds cost for count entities (mostly seekers, some
+// bullets and bouncers), virtual calls on heap objects versus the entity
+// store systems, with the final positions compared.
+void benchmarkEntities(int count, int ticks)
+{
+    const float dt = 1.0 / 120;
+    const float speed = 10;
+    float3 target(0, 0, 0);
+    std::vector<LegacyEntity*> legacy;
+    EntityStore store;
+    std::vector<unsigned int> handles(count);
+    for(int i = 0; i < count; i++){
+        int roll = rand() % 20;
+        LegacyEntity* l;
+        EntityStore::Kind kind;
+        if(roll < 16){
+            l = new LegacySeeker();
+            kind = EntityStore::Seeker;
+        }
+        else if(roll < 19){
+            l = new LegacyBullet();
+            kind = EntityStore::Bullet;
+        }
+        else{
+            l = new LegacyBouncer();
+            kind = EntityStore::Bouncer;
+        }
+        float3 r = float3::random();
+        l->position = float3(r.x * 2 * dimension - dimension, kind == EntityStore::Bouncer ? 10 : 0, r.z * 2 * dimension - dimension);
+        if(kind != EntityStore::Seeker)
+            l->velocity = float3(r.y * 100 - 50, 0, r.x * 100 - 50);
+        l->angularVelocity = kind == EntityStore::Bouncer ? 1 : 0;
+        legacy.push_back(l);
+        unsigned int e = store.create(kind, &handles[i]);
+        store.position[e] = l->position;
+        store.velocity[e] = l->velocity;
+        store.angularVelocity[e] = l->angularVelocity;
+    }
+    // in a long game objects are spawned and freed over time, their order in
+    // `objects` has little to do with where they sit in memory
+    for(int i = count - 1; i > 0; i--){
+        int j = rand() % (i + 1);
+        std::swap(legacy[i], legacy[j]);
+        std::swap(handles[i], handles[j]);
+    }
+    
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for(int tick = 0; tick < ticks; tick++){
+        for(int i = 0; i < count; i++)
+            legacy[i]->move(target, speed, dt);
+        for(int i = 0; i < count; i++)
+            legacy[i]->control(dimension);
+    }
+    double legacyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / ticks;
+    
+    start = std::chrono::high_resolution_clock::now();
+    for(int tick = 0; tick < ticks; tick++){
+        store.steerSeekers(target, speed, dt);
+        store.integrateBullets(dt);
+        store.bounceBouncers(dt, 1);
+        store.clampToArena(dimension);
+    }
+    double storeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / ticks;
+    
+    float maxError = 0;
+    for(int i = 0; i < count; i++){
+        maxError = std::max(maxError, (legacy[i]->position - store.position[handles[i]]).norm());
+        delete legacy[i];
+    }
+    printf("%d entities: objects %.3f ms/tick, entity store %.3f ms/tick, %.1fx, max position difference %g\n",
+           count, legacyMs, storeMs, legacyMs / storeMs, maxError);
+}
+
+// Seeker steering for count seekers over ticks steps: the float3 path
+// (LegacySeeker::move) against the batched kernel on every path this CPU
+// runs, reporting time per tick and the largest differences after the run.
+void benchmarkSeekers(int count, int ticks)
+{
+    const float dt = 1.0 / 120;
+    const float speed = 10;
+    float3 target(3, 1.5, -7);
+    std::vector<LegacySeeker> reference(count);
+    std::vector<float> start(3 * count);
+    std::vector<unsigned char> kinds(count, EntityStore::Seeker), flags(count);
+    for(int i = 0; i < count; i++){
+        float3 r = float3::random();
+        reference[i].position = float3(r.x * 2 * dimension - dimension, 0, r.z * 2 * dimension - dimension);
+        reference[i].isDead = rand() % 10 == 0;
+        start[i] = reference[i].position.x;
+        start[count + i] = reference[i].position.y;
+        start[2 * count + i] = reference[i].position.z;
+        flags[i] = reference[i].isDead ? EntityStore::Dead : 0;
+    }
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    for(int tick = 0; tick < ticks; tick++)
+        for(int i = 0; i < count; i++)
+            reference[i].move(target, speed, dt);
+    double referenceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count() / ticks;
+    printf("%d seekers: float3 %.3f ms/tick\n", count, referenceMs);
+    
+    std::vector<float> lanes(7 * count);
+    for(int path = SeekerKernelScalar; path <= SeekerKernelAvx; path++){
+        if(!isSeekerKernelAvailable((SeekerKernelPath)path))
+            continue;
+        SeekerBatch batch;
+        batch.x = lanes.data();
+        batch.y = batch.x + count;
+        batch.z = batch.y + count;
+        batch.vx = batch.z + count;
+        batch.vy = batch.vx + count;
+        batch.vz = batch.vy + count;
+        batch.heading = batch.vz + count;
+        batch.kind = kinds.data();
+        batch.flags = flags.data();
+        batch.seekerKind = EntityStore::Seeker;
+        batch.deadFlag = EntityStore::Dead;
+        batch.count = count;
+        std::copy(start.begin(), start.end(), lanes.begin());
+        t0 = std::chrono::high_resolution_clock::now();
+        for(int tick = 0; tick < ticks; tick++)
+            steerSeekers(batch, target, speed, dt, (SeekerKernelPath)path);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count() / ticks;
+        
+        float positionError = 0, velocityError = 0, headingError = 0;
+        for(int i = 0; i < count; i++){
+            const LegacySeeker& r = reference[i];
+            positionError = std::max(positionError, (r.position - float3(batch.x[i], batch.y[i], batch.z[i])).norm());
+            velocityError = std::max(velocityError, (r.velocity - float3(batch.vx[i], batch.vy[i], batch.vz[i])).norm());
+            headingError = std::max(headingError, fabsf(r.orientationAngle - batch.heading[i]));
+        }
+        bool ok = positionError < 1e-2 && velocityError < 1e-3 && headingError < 1e-2;
+        printf("    %-6s %.3f ms/tick, %.1fx, max error: position %g, velocity %g, heading %g deg %s\n",
+               seekerKernelName((SeekerKernelPath)path), ms, referenceMs / ms, positionError, velocityError, headingError,
+               ok ? "ok" : "FAILED");
+    }
+}
+
 int main(int argc, char **argv) {
+    // ./3DGame --bench-load [runs] : OBJ load times, old loader vs single-pass parser
+    if(argc > 1 && strcmp(argv[1], "--bench-load") == 0){
+        int runs = argc > 2 ? atoi(argv[2]) : 5;
+        Mesh::benchmarkLoad("meshpack/chevy/chevy.obj", runs);
+        Mesh::benchmarkLoad("meshpack/tigger.obj", runs);
+        Mesh::benchmarkLoad("meshpack/tree/smoothtree.obj", runs);
+        return 0;
+    }
+    // ./3DGame --bench-parse [maxThreads] : OBJ parse scaling over 1..maxThreads threads
+    if(argc > 1 && strcmp(argv[1], "--bench-parse") == 0){
+        int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+        Mesh::benchmarkParseThreads("meshpack/chevy/chevy.obj", maxThreads, 5);
+        Mesh::benchmarkParseThreads("meshpack/tigger.obj", maxThreads, 5);
+        Mesh::benchmarkParseThreads("meshpack/tree/smoothtree.obj", maxThreads, 5);
+        Mesh::benchmarkParseSynthetic(1200, maxThreads, 2);
+        return 0;
+    }
+    // ./3DGame --bench-collision : contact tests per tick, brute force vs spatial grid
+    if(argc > 1 && strcmp(argv[1], "--bench-collision") == 0){
+        benchmarkCollision(1000);
+        benchmarkCollision(10000);
+        benchmarkCollision(100000);
+        return 0;
+    }
+    // ./3DGame --bench-entities : per-tick movement, Object hierarchy vs entity store
+    if(argc > 1 && strcmp(argv[1], "--bench-entities") == 0){
+        benchmarkEntities(1000, 200);
+        benchmarkEntities(10000, 50);
+        benchmarkEntities(100000, 10);
+        return 0;
+    }
+    // ./3DGame --bench-seekers : seeker steering, float3 path vs scalar/SSE/AVX kernel
+    if(argc > 1 && strcmp(argv[1], "--bench-seekers") == 0){
+        benchmarkSeekers(1000, 200);
+        benchmarkSeekers(10000, 50);
+        benchmarkSeekers(100000, 10);
+        return 0;
+    }
+    // --seeker-kernel scalar|sse|avx : steering path for everything below, SSE where available by default
+    for(int i = 1; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--seeker-kernel") != 0)
+            continue;
+        SeekerKernelPath path;
+        if(!parseSeekerKernel(argv[++i], path)){
+            printf("seeker kernel %s: unknown or not supported here\n", argv[i]);
+            return 1;
+        }
+        entities.setSeekerKernel(path);
+    }
+    // ./3DGame --bench-gameplay [options] : replayed input at escalating scores, see GameplayBenchmark
+    bool benchmarkGameplay = false;
+    if(argc > 1 && strcmp(argv[1], "--bench-gameplay") == 0){
+        if(!setUpGameplayBenchmark(argc, argv)){
+            while(gameplay.step())
+                ;
+            return gameplay.report();
+        }
+        benchmarkGameplay = true;
+    }
+#ifdef HEADLESS
+    return runHeadless(argc, argv);
+#endif
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--headless") == 0)
+            return runHeadless(argc, argv);
+        if(strcmp(argv[i], "--legacy-gl") == 0){
+            useBufferObjects = false;
+            Mesh::setUseBufferObjects(false);
+        }
+        if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            inputRecord = fopen(argv[++i], "w");
+        if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        if(strcmp(argv[i], "--gl-stats") == 0 && i + 1 < argc)
+            glStatsLog = fopen(argv[++i], "w");
+        if(strcmp(argv[i], "--shadow-map") == 0 && i + 1 < argc)
+            shadowMap.setSize(atoi(argv[++i]));
+        if(strcmp(argv[i], "--no-cull") == 0)
+            frustumCulling = false;
+        if(strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            lodPixelError = atof(argv[++i]);
+        if(strcmp(argv[i], "--impostor-distance") == 0 && i + 1 < argc)
+            impostorDistance = atof(argv[++i]);
+        if(strcmp(argv[i], "--no-state-cache") == 0)
+            renderState.setEnabled(false);
+    }
+    // GLUT leaves through exit(), so the trace is written from there
+    if(tracePath){
+        profiler.startTrace();
+        atexit(writeTrace);
+    }
+    
     glutInit(&argc, argv);						// initialize GLUT
     glutInitWindowSize(600, 600);				// startup window size 
     glutInitWindowPosition(100, 100);           // where to put window on screen
@@ -1095,6 +2701,18 @@ int main(int argc, char **argv) {
     
     glViewport(0, 0, 600, 600);
     
+    glEnable(GL_LIGHTING);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_NORMALIZE);
+    
+    if(benchmarkGameplay){
+        // no input and no idle stepping, every frame is one benchmark tick
+        glutDisplayFunc(onBenchmarkDisplay);
+        glutReshapeFunc(onReshape);
+        glutMainLoop();
+        return 0;
+    }
+    
     glutDisplayFunc(onDisplay);					// register callback
     glutIdleFunc(onIdle);						// register callback
     glutReshapeFunc(onReshape);
@@ -1103,10 +2721,6 @@ int main(int argc, char **argv) {
     glutMouseFunc(onMouse);
     glutMotionFunc(onMouseMotion);
     
-    glEnable(GL_LIGHTING);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_NORMALIZE);
-    
     scene.initialize();
     for(int i=0; i<256; i++)
         keysPressed.push_back(false);
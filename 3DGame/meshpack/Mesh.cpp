@@ -1,9 +1,15 @@
 
 // OBJ Parsing by Soeren Walls, 2015
 
+#define _USE_MATH_DEFINES
+#include <math.h>
 #include <fstream>
 #include <algorithm>
 
+#ifdef HEADLESS
+// simulation only, see HeadlessGL.h
+#include "HeadlessGL.h"
+#else
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 // Needed on MsWindows
 #include <windows.h>
@@ -13,249 +19,1467 @@
 #include <OpenGL/glu.h>
 // Download glut from: http://www.opengl.org/resources/libraries/glut/
 #include <GLUT/glut.h>
+#endif
 
-#include "mesh.h"
+#include "Mesh.h"
+#include "MeshSimplifier.h"
+// counts the GL calls made from here on
+#include "GLStats.h"
 #include <cstdio>
+#include <cstring>
 #include <sstream>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <functional>
+#include <atomic>
 
 using namespace std;
 
-Mesh::Mesh(const char *filename)
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+#define MESH_NO_MMAP
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
+// Read-only view of a whole file (OBJ text or a mesh cache). Mapped where
+// the platform allows it, otherwise read in one go, so it can be parsed in place.
+struct MappedFile
 {
-	fstream file(filename); 
-	if(!file.is_open())       
+    const char*     data;
+    size_t          size;
+    void*           mapping;
+    vector<char>    buffer;
+
+    MappedFile():data(NULL),size(0),mapping(NULL){}
+
+    bool open(const char *filename)
     {
-        // char * dir = getcwd(NULL, 0); // Platform-dependent, see reference link below
-        // printf("Current dir: %s\n", dir);
-        printf("file %s not found\n", filename);
-		return;
-	}
-
-	char buffer[256];
-	while(!file.eof())
-	{
-		file.getline(buffer,256);
-		rows.push_back(new string(buffer));
-	}
-
-	submeshFaces.push_back(std::vector<Face*>());
-	std::vector<Face*>* faces = &submeshFaces.at(submeshFaces.size()-1);
-
-	for(int i = 0; i < rows.size(); i++)
-	{
-		if(rows[i]->empty() || (*rows[i])[0] == '#' || (*rows[i])[0] == 's' || (*rows[i])[0] == 'u') // usemtl
-			continue;      
-		else if((*rows[i])[0] == 'v' && (*rows[i])[1] == ' ')
-		{
-			float tmpx,tmpy,tmpz;
-			sscanf(rows[i]->c_str(), "v %f %f %f" ,&tmpx,&tmpy,&tmpz);      
-			positions.push_back(new float3(tmpx,tmpy,tmpz));  
-		}
-		else if((*rows[i])[0] == 'v' && (*rows[i])[1] == 'n')
-		{
-			float tmpx,tmpy,tmpz;
-			sscanf(rows[i]->c_str(), "vn %f %f %f" ,&tmpx,&tmpy,&tmpz);
-			normals.push_back(new float3(tmpx,tmpy,tmpz));
-		}
-		else if((*rows[i])[0] == 'v' && (*rows[i])[1] == 't')
-		{
-			float tmpx,tmpy;
-			sscanf(rows[i]->c_str(), "vt %f %f" ,&tmpx,&tmpy);
-			texcoords.push_back(new float2(tmpx,tmpy));
-		}
-		else if((*rows[i])[0] == 'f')  
-		{
-            Face* f = new Face();
-            int numVert = -1; // instantiate to -1 in order to skip the "f" at the beginning
-            string format1 = "%d/%d/%d"; // given position, texture, and normal
-            string format2 = "%d//%d"; // given only position and normal
-            string format3 = "%d/%d"; // given only position and texture
-            istringstream row(*rows[i]);
-            string word;
-            // for each description of vertex position, texture, and normal
-            while(row >> word) {
-                if(numVert > -1) {
-                    int matched = sscanf(word.c_str(), format1.c_str(),
-                           &f->positionIndices[numVert],
-                           &f->texcoordIndices[numVert],
-                           &f->normalIndices[numVert]);
-                    if(matched < 3) {
-                        matched = sscanf(word.c_str(), format2.c_str(),
-                               &f->positionIndices[numVert],
-                               &f->normalIndices[numVert]);
-                        f->texcoordIndices[numVert] = 0;
-                        if(matched == 2)
-                            printf("Texture cannot be applied to this .obj without texCoords.\n");
-                    }
-                    if(matched < 2) {
-                        matched = sscanf(word.c_str(), format3.c_str(),
-                                         &f->positionIndices[numVert],
-                                         &f->texcoordIndices[numVert]);
-                        f->normalIndices[numVert] = 0;
-                    }
-                    if(matched < 2) {
-                        printf("Error parsing OBJ file: %s\n", filename);
-                        return;
-                    }
-                }
-                numVert++;
-                if(numVert > 5) {
-                    break; // don't allow polygons with > 5 vertices
-                }
+#ifndef MESH_NO_MMAP
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p != MAP_FAILED)
+            {
+                mapping = p;
+                data = (const char*)p;
+                size = st.st_size;
             }
-            f->isQuad = numVert == 4;
-            f->isPentagon = numVert == 5;
-            faces->push_back(f);
-		}
-		else if((*rows[i])[0] == 'g')
-		{
-			if(faces->size() > 0)
-			{
-				submeshFaces.push_back(std::vector<Face*>());
-				faces = &submeshFaces.at(submeshFaces.size()-1);
-			}
         }
-                  
-	}
+        ::close(fd);
+        if(mapping)
+            return true;
+#endif
+        FILE* f = fopen(filename, "rb");
+        if(!f)
+            return false;
+        char chunk[1 << 16];
+        size_t n;
+        while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + n);
+        fclose(f);
+        data = buffer.empty() ? "" : &buffer[0];
+        size = buffer.size();
+        return true;
+    }
+
+    ~MappedFile()
+    {
+#ifndef MESH_NO_MMAP
+        if(mapping)
+            munmap(mapping, size);
+#endif
+    }
+};
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipBlanks(const char* p, const char* end)
+{
+    while(p < end && isBlank(*p))
+        p++;
+    return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end)
+{
+    while(p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+// returns NULL if there is no number at p
+static const char* scanInt(const char* p, const char* end, int& out)
+{
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if(p >= end || *p < '0' || *p > '9')
+        return NULL;
+    int value = 0;
+    while(p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    out = negative ? -value : value;
+    return p;
+}
+
+// returns NULL if there is no number at p
+static const char* scanFloat(const char* p, const char* end, float& out)
+{
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    int significant = 0;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+        if(significant < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if(mantissa) significant++;
+        }
+        else
+            exponent++;
+        p++; digits++;
+    }
+    if(p < end && *p == '.')
+    {
+        p++;
+        while(p < end && *p >= '0' && *p <= '9')
+        {
+            if(significant < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if(mantissa) significant++;
+                exponent--;
+            }
+            p++; digits++;
+        }
+    }
+    if(digits == 0)
+        return NULL;
+    if(p < end && (*p == 'e' || *p == 'E'))
+    {
+        int e;
+        const char* q = scanInt(p + 1, end, e);
+        if(q) {
+            exponent += e;
+            p = q;
+        }
+    }
+
+    double value = (double)mantissa;
+    if(exponent < 0)
+        value = -exponent <= 22 ? value / powersOfTen[-exponent] : value * pow(10.0, exponent);
+    else if(exponent > 0)
+        value = exponent <= 22 ? value * powersOfTen[exponent] : value * pow(10.0, exponent);
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+// reads up to n floats, missing trailing components stay 0
+static const char* scanFloats(const char* p, const char* end, float* out, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        out[i] = 0;
+        p = skipBlanks(p, end);
+        const char* q = scanFloat(p, end, out[i]);
+        if(!q)
+            break;
+        p = q;
+    }
+    return p;
+}
 
-	modelid = glGenLists(submeshFaces.size());
+// What one parser thread produces for its slice of the file. Negative
+// (relative) OBJ indices are resolved against the slice's own counts and
+// flagged; the merge adds the counts of the slices before it.
+struct Mesh::ObjChunk
+{
+    vector<float3>          positions;
+    vector<float3>          normals;
+    vector<float2>          texcoords;
+    vector<Corner>          corners;        // three per triangle
+    vector<unsigned char>   relative;       // per corner, which indices are slice-relative
+    vector<unsigned int>    groups;         // slice triangle count at each 'g' line
+    bool                    failed;
+    bool                    missingTexcoords;
 
-	for(int iSubmesh=0; iSubmesh<submeshFaces.size(); iSubmesh++)
-	{
-		std::vector<Face*>& faces = submeshFaces.at(iSubmesh);
+    ObjChunk():failed(false),missingTexcoords(false){}
+};
 
-        glNewList(modelid + iSubmesh,GL_COMPILE);
-        
-        float3 *normal, *pos;
-        float2 *texCoord;
+enum { relativePosition = 1, relativeTexcoord = 2, relativeNormal = 4 };
 
-		glBegin(GL_TRIANGLES);
-		for(int i=0;i<faces.size();i++)
+// OBJ indices are 1-based, negative ones count back from the latest element.
+// Returns the 0-based index (-1 if absent); relative ones get their flag set.
+static inline int resolveIndex(int index, size_t count, unsigned char& relative, unsigned char flag)
+{
+    if(index < 0) {
+        relative |= flag;
+        return index + (int)count;
+    }
+    return index - 1;
+}
+
+void Mesh::parseChunk(const char* p, const char* end, ObjChunk& out, const char *filename)
+{
+    while(p < end)
+    {
+        p = skipBlanks(p, end);
+        if(p >= end)
+            break;
+        const char* lineStart = p;
+        char c0 = *p;
+        char c1 = p + 1 < end ? p[1] : '\n';
+
+        if(c0 == 'v' && isBlank(c1))
+        {
+            float v[3];
+            p = scanFloats(p + 1, end, v, 3);
+            out.positions.push_back(float3(v[0],v[1],v[2]));
+        }
+        else if(c0 == 'v' && c1 == 'n')
+        {
+            float v[3];
+            p = scanFloats(p + 2, end, v, 3);
+            out.normals.push_back(float3(v[0],v[1],v[2]));
+        }
+        else if(c0 == 'v' && c1 == 't')
         {
-            if(faces[i]->isPentagon)
+            float v[2];
+            p = scanFloats(p + 2, end, v, 2);
+            out.texcoords.push_back(float2(v[0],v[1]));
+        }
+        else if(c0 == 'f' && isBlank(c1))
+        {
+            // polygons are fan-triangulated as their corners are read
+            Corner first, previous;
+            unsigned char firstRelative = 0, previousRelative = 0;
+            int numVert = 0;
+            p = skipBlanks(p + 1, end);
+            // each corner is one of v, v/t, v//n or v/t/n
+            while(p < end && *p != '\n' && *p != '#')
             {
-                for(int j=0; j<3; j++) {
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
+                int v = 0, t = 0, n = 0;
+                const char* q = scanInt(p, end, v);
+                if(q && q < end && *q == '/')
+                {
+                    q++;
+                    if(q < end && *q != '/')
+                        q = scanInt(q, end, t);
+                    if(q && q < end && *q == '/')
+                        q = scanInt(q + 1, end, n);
                 }
-                for(int j=1; j<4; j++) {
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
+                if(!q || (q < end && !isBlank(*q) && *q != '\n'))
+                {
+                    printf("Error parsing OBJ file: %s (line starting '%.20s')\n", filename, lineStart);
+                    out.failed = true;
+                    return;
                 }
-                for(int j=2; j<5; j++) {
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
+                if(t == 0 && n != 0)
+                    out.missingTexcoords = true;
+
+                Corner c;
+                unsigned char relative = 0;
+                c.position = resolveIndex(v, out.positions.size(), relative, relativePosition);
+                c.texcoord = resolveIndex(t, out.texcoords.size(), relative, relativeTexcoord);
+                c.normal = resolveIndex(n, out.normals.size(), relative, relativeNormal);
+                if(numVert == 0) {
+                    first = c;
+                    firstRelative = relative;
                 }
+                else if(numVert >= 2)
+                {
+                    out.corners.push_back(first);
+                    out.corners.push_back(previous);
+                    out.corners.push_back(c);
+                    out.relative.push_back(firstRelative);
+                    out.relative.push_back(previousRelative);
+                    out.relative.push_back(relative);
+                }
+                previous = c;
+                previousRelative = relative;
+                numVert++;
+                p = skipBlanks(q, end);
             }
-			else if(faces[i]->isQuad)
+        }
+        else if(c0 == 'g')
+            out.groups.push_back(out.corners.size() / 3);
+        // comments, s, o, usemtl and mtllib are ignored
+        p = skipLine(p, end);
+    }
+}
+
+// Copies one slice's arrays into place at the offsets of the slices before
+// it, rebasing its relative indices; the arrays are sized beforehand, so the
+// slices merge on their own threads too.
+void Mesh::mergeChunk(ObjChunk& chunk, size_t positionBase, size_t normalBase, size_t texcoordBase, size_t cornerBase)
+{
+    copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionBase);
+    copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normalBase);
+    copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + texcoordBase);
+    Corner* out = corners.data() + cornerBase;
+    for(unsigned int i = 0; i < chunk.corners.size(); i++)
+    {
+        Corner c = chunk.corners[i];
+        unsigned char relative = chunk.relative[i];
+        if(relative & relativePosition) c.position += positionBase;
+        if(relative & relativeTexcoord) c.texcoord += texcoordBase;
+        if(relative & relativeNormal) c.normal += normalBase;
+        out[i] = c;
+    }
+    vector<float3>().swap(chunk.positions); // release slice memory as we go
+    vector<float3>().swap(chunk.normals);
+    vector<float2>().swap(chunk.texcoords);
+    vector<Corner>().swap(chunk.corners);
+    vector<unsigned char>().swap(chunk.relative);
+}
+
+// Large files are split into line-aligned slices parsed on their own threads.
+static int defaultParseThreads(size_t size)
+{
+    if(size < (1 << 20))
+        return 1;
+    unsigned int cores = thread::hardware_concurrency();
+    return cores < 1 ? 1 : cores > 8 ? 8 : cores;
+}
+
+Mesh::Mesh():vertexBuffer(0),indexBuffer(0),displayLists(0),wideIndices(false),prepared(false),ready(false)
+{
+}
+
+Mesh::Mesh(const char *filename):filename(filename),vertexBuffer(0),indexBuffer(0),displayLists(0),wideIndices(false),prepared(false),ready(false)
+{
+}
+
+void Mesh::prepare()
+{
+    const char* name = filename.c_str();
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    bool cached = loadCache(name);
+    if(!cached && load(name))
+    {
+        buildVertices(name);
+        optimizeVertexCache(name);
+        buildLods(name);
+        writeCache(name);
+    }
+
+    computeBounds();
+    printf("%s: loaded from %s in %.2f ms\n", name, cached ? "mesh cache" : "OBJ",
+           chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+    prepared.store(true, memory_order_release);
+}
+
+// A UV sphere built in memory, for objects that used to be drawn with
+// glutSolidSphere; prepared on return, upload() still needs the GL thread.
+Mesh* Mesh::createSphere(float radius, int slices, int stacks)
+{
+    Mesh* mesh = new Mesh();
+    mesh->filename = "sphere";
+    for(int stack = 0; stack <= stacks; stack++)
+    {
+        float phi = M_PI * stack / stacks;
+        for(int slice = 0; slice <= slices; slice++)
+        {
+            float theta = 2 * M_PI * slice / slices;
+            Vertex v;
+            v.normal = float3(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+            v.position = v.normal * radius;
+            v.texcoord = float2((float)slice / slices, (float)stack / stacks);
+            mesh->vertices.push_back(v);
+        }
+    }
+    for(int stack = 0; stack < stacks; stack++)
+    {
+        for(int slice = 0; slice < slices; slice++)
+        {
+            unsigned int a = stack * (slices + 1) + slice;
+            unsigned int b = a + slices + 1;
+            unsigned int quad[6] = { a, a + 1, b, a + 1, b + 1, b };
+            mesh->indices.insert(mesh->indices.end(), quad, quad + 6);
+        }
+    }
+    Submesh all = { 0, (unsigned int)mesh->indices.size() / 3 };
+    mesh->submeshes.push_back(all);
+    mesh->computeBounds();
+    mesh->prepared.store(true, memory_order_release);
+    return mesh;
+}
+
+// The box around the vertices an index range uses and the smallest sphere
+// around them centred on the box; nothing gives an empty box at the origin.
+Mesh::Bounds Mesh::boundsOf(const unsigned int *index, const unsigned int *indexEnd) const
+{
+    Bounds b;
+    b.radius = 0;
+    if(index == indexEnd)
+        return b;
+    b.boxMin = b.boxMax = vertices[*index].position;
+    for(const unsigned int* i = index + 1; i != indexEnd; i++)
+    {
+        const float3& p = vertices[*i].position;
+        b.boxMin = float3(min(b.boxMin.x, p.x), min(b.boxMin.y, p.y), min(b.boxMin.z, p.z));
+        b.boxMax = float3(max(b.boxMax.x, p.x), max(b.boxMax.y, p.y), max(b.boxMax.z, p.z));
+    }
+    b.center = (b.boxMin + b.boxMax) * 0.5f;
+    float radius2 = 0;
+    for(const unsigned int* i = index; i != indexEnd; i++)
+        radius2 = max(radius2, (vertices[*i].position - b.center).norm2());
+    b.radius = sqrtf(radius2);
+    return b;
+}
+
+// per submesh over its own triangles, the whole mesh over all of them
+void Mesh::computeBounds()
+{
+    const unsigned int* first = indices.data();
+    bounds = boundsOf(first, first + indices.size());
+    submeshBounds.resize(submeshes.size());
+    for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+    {
+        const Submesh& s = submeshes[iSubmesh];
+        submeshBounds[iSubmesh] = boundsOf(first + s.firstTriangle * 3, first + (s.firstTriangle + s.triangleCount) * 3);
+    }
+}
+
+bool Mesh::isPrepared() const
+{
+    return prepared.load(memory_order_acquire);
+}
+
+bool Mesh::load(const char *filename, int threads)
+{
+    MappedFile file;
+    if(!file.open(filename))
+    {
+        // char * dir = getcwd(NULL, 0); // Platform-dependent, see reference link below
+        // printf("Current dir: %s\n", dir);
+        printf("file %s not found\n", filename);
+        return false;
+    }
+    parse(file.data, file.size, filename, threads);
+    return true;
+}
+
+void Mesh::parse(const char *data, size_t size, const char *name, int threads)
+{
+    if(threads <= 0)
+        threads = defaultParseThreads(size);
+    const char* end = data + size;
+
+    // slice boundaries, each moved forward to the start of a line
+    vector<const char*> bounds(threads + 1, end);
+    bounds[0] = data;
+    for(int i = 1; i < threads; i++)
+    {
+        const char* p = data + size / threads * i;
+        if(p < bounds[i - 1])
+            p = bounds[i - 1];
+        while(p > data && p < end && p[-1] != '\n')
+            p++;
+        bounds[i] = p;
+    }
+
+    vector<ObjChunk> chunks(threads);
+    vector<thread> workers;
+    for(int i = 1; i < threads; i++)
+        workers.push_back(thread(parseChunk, bounds[i], bounds[i + 1], ref(chunks[i]), name));
+    parseChunk(bounds[0], bounds[1], chunks[0], name);
+    for(unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    // a failed slice ends the mesh there, like the error would in a serial parse;
+    // each slice's arrays go after those of the slices before it
+    int used = 0;
+    size_t positionCount = 0, normalCount = 0, texcoordCount = 0, cornerCount = 0;
+    vector<size_t> positionBase(threads), normalBase(threads), texcoordBase(threads), cornerBase(threads);
+    bool missingTexcoords = false;
+    while(used < threads)
+    {
+        positionBase[used] = positionCount;
+        normalBase[used] = normalCount;
+        texcoordBase[used] = texcoordCount;
+        cornerBase[used] = cornerCount;
+        const ObjChunk& c = chunks[used++];
+        positionCount += c.positions.size();
+        normalCount += c.normals.size();
+        texcoordCount += c.texcoords.size();
+        cornerCount += c.corners.size();
+        missingTexcoords |= c.missingTexcoords;
+        if(c.failed)
+            break;
+    }
+    if(missingTexcoords)
+        printf("Texture cannot be applied to %s without texCoords.\n", name);
+
+    positions.resize(positionCount);
+    normals.resize(normalCount);
+    texcoords.resize(texcoordCount);
+    corners.resize(cornerCount);
+    workers.clear();
+    for(int k = 1; k < used; k++)
+        workers.push_back(thread(&Mesh::mergeChunk, this, ref(chunks[k]), positionBase[k], normalBase[k], texcoordBase[k], cornerBase[k]));
+    if(used > 0)
+        mergeChunk(chunks[0], 0, 0, 0, 0);
+    for(unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    Submesh first = {0, 0};
+    submeshes.push_back(first);
+    for(int k = 0; k < used; k++)
+    {
+        // a 'g' line starts a new submesh unless the current one is still empty
+        const ObjChunk& chunk = chunks[k];
+        for(unsigned int i = 0; i < chunk.groups.size(); i++)
+        {
+            unsigned int triangle = cornerBase[k] / 3 + chunk.groups[i];
+            if(triangle > submeshes.back().firstTriangle)
             {
-                for(int j=0; j<4; j++) {
-                    if(j==3) continue;
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
-                }
-                for(int j=0; j<4; j++) {
-                    if(j==1) continue;
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
+                submeshes.back().triangleCount = triangle - submeshes.back().firstTriangle;
+                Submesh s = {triangle, 0};
+                submeshes.push_back(s);
+            }
+        }
+    }
+    submeshes.back().triangleCount = corners.size() / 3 - submeshes.back().firstTriangle;
+}
+
+// orders vertex ids by the bytes of their vertices
+struct VertexBytesLess
+{
+    const unsigned char*    table;
+    size_t                  size;
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        return memcmp(table + a * size, table + b * size, size) < 0;
+    }
+};
+
+// For each of count entries of size bytes, the first entry with the same
+// bytes. Exporters often repeat values under new indices (tigger has one
+// texcoord per corner, 848 distinct among 7248; smoothtree writes most
+// positions twice), so OBJ indices alone miss most shared vertices.
+static vector<int> firstWithSameBytes(const void* table, size_t size, unsigned int count)
+{
+    VertexBytesLess less = { (const unsigned char*)table, size };
+    vector<unsigned int> order(count);
+    for(unsigned int i = 0; i < count; i++)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), less);
+    vector<int> first(count);
+    for(unsigned int i = 0; i < count; i++)
+        first[order[i]] = i > 0 && !less(order[i - 1], order[i]) ? first[order[i - 1]] : order[i];
+    return first;
+}
+
+// Merges corners that share position, normal and texcoord values into one
+// vertex. Corners are chained per position, so the lookup only compares the
+// few vertices that sit on the same OBJ position.
+void Mesh::buildVertices(const char *name)
+{
+    vertices.clear();
+    indices.clear();
+    vertices.reserve(positions.size());
+    indices.reserve(corners.size());
+
+    vector<int> firstAtPosition(positions.size(), -1);
+    vector<int> nextAtPosition;
+    nextAtPosition.reserve(positions.size());
+    vector<Corner> vertexCorners;
+    vertexCorners.reserve(positions.size());
+    vector<int> positionOf = firstWithSameBytes(positions.data(), sizeof(float3), positions.size());
+    vector<int> texcoordOf = firstWithSameBytes(texcoords.data(), sizeof(float2), texcoords.size());
+    vector<int> normalOf = firstWithSameBytes(normals.data(), sizeof(float3), normals.size());
+
+    for(unsigned int i = 0; i < corners.size(); i++)
+    {
+        Corner c = corners[i];
+        if(c.position < 0 || c.position >= (int)positions.size())
+            c.position = 0;
+        if(c.texcoord >= (int)texcoords.size())
+            c.texcoord = -1;
+        if(c.normal >= (int)normals.size())
+            c.normal = -1;
+        if(positions.empty())
+            break;
+        c.position = positionOf[c.position];
+        if(c.texcoord >= 0)
+            c.texcoord = texcoordOf[c.texcoord];
+        if(c.normal >= 0)
+            c.normal = normalOf[c.normal];
+
+        int found = firstAtPosition[c.position];
+        while(found >= 0 && (vertexCorners[found].texcoord != c.texcoord || vertexCorners[found].normal != c.normal))
+            found = nextAtPosition[found];
+
+        if(found < 0)
+        {
+            Vertex v;
+            v.position = positions[c.position];
+            v.normal = c.normal >= 0 ? normals[c.normal] : float3(0, 1, 0);
+            v.texcoord = c.texcoord >= 0 ? float2(texcoords[c.texcoord].x, 1 - texcoords[c.texcoord].y) : float2();
+            found = vertices.size();
+            vertices.push_back(v);
+            vertexCorners.push_back(c);
+            nextAtPosition.push_back(firstAtPosition[c.position]);
+            firstAtPosition[c.position] = found;
+        }
+        indices.push_back(found);
+    }
+
+    if(!corners.empty())
+        printf("%s: %d corners -> %d unique vertices (%.1f%%), %d-bit indices\n",
+               name, (int)corners.size(), (int)vertices.size(),
+               100.0f * uniqueVertexRatio(), vertices.size() > 0xffff ? 32 : 16);
+
+    // the OBJ attribute arrays are not needed once the vertex table exists
+    vector<float3>().swap(positions);
+    vector<float3>().swap(normals);
+    vector<float2>().swap(texcoords);
+    vector<Corner>().swap(corners);
+}
+
+float Mesh::uniqueVertexRatio() const
+{
+    return indices.empty() ? 1.0f : (float)vertices.size() / indices.size();
+}
+
+// Post-transform cache reuse: misses per triangle for a FIFO cache of the
+// given size. 3.0 is the worst case, ~0.5 is about the best a mesh can do.
+static float averageCacheMissRatio(const unsigned int* idx, size_t count, size_t vertexCount, int cacheSize)
+{
+    if(count < 3)
+        return 0;
+    // a vertex is cached while fewer than cacheSize misses happened since it was loaded
+    vector<int> loadedAt(vertexCount, -cacheSize);
+    int misses = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(misses - loadedAt[idx[i]] >= cacheSize)
+            loadedAt[idx[i]] = ++misses;
+    }
+    return (float)misses / (count / 3);
+}
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation", 2006
+static const int    forsythCacheSize = 32;
+
+static float forsythVertexScore(int cachePosition, int remainingTriangles)
+{
+    if(remainingTriangles == 0)
+        return -1.0f;
+    float score = 0.0f;
+    if(cachePosition >= 0)
+    {
+        if(cachePosition < 3) // the triangle just drawn
+            score = 0.75f;
+        else
+            score = powf(1.0f - (cachePosition - 3) / (float)(forsythCacheSize - 3), 1.5f);
+    }
+    // favour vertices with few triangles left, so they get finished off
+    return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+}
+
+// Reorders the triangles of one index range in place; idx uses local vertex ids < vertexCount.
+static void forsythReorder(unsigned int* idx, unsigned int triangleCount, unsigned int vertexCount)
+{
+    vector<int> remaining(vertexCount, 0);
+    for(unsigned int i = 0; i < triangleCount * 3; i++)
+        remaining[idx[i]]++;
+
+    // triangles around each vertex, emitted ones are swapped out of the live range
+    vector<int> adjacencyStart(vertexCount + 1, 0);
+    for(unsigned int v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+    vector<int> adjacency(triangleCount * 3);
+    vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for(unsigned int i = 0; i < triangleCount * 3; i++)
+        adjacency[fill[idx[i]]++] = i / 3;
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> vertexScore(vertexCount);
+    for(unsigned int v = 0; v < vertexCount; v++)
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+
+    vector<char> emitted(triangleCount, 0);
+
+    vector<unsigned int> output;
+    output.reserve(triangleCount * 3);
+    int cache[forsythCacheSize + 3];
+    int cacheCount = 0;
+    unsigned int cursor = 0;
+    int best = -1;
+
+    for(unsigned int n = 0; n < triangleCount; n++)
+    {
+        if(best < 0)
+        {
+            // nothing in the cache touches a live triangle: continue with the next one in file order
+            while(emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+
+        emitted[best] = 1;
+        int newCache[forsythCacheSize + 3];
+        int newCount = 0;
+        for(int k = 0; k < 3; k++)
+        {
+            unsigned int v = idx[best*3 + k];
+            output.push_back(v);
+            newCache[newCount++] = v;
+            int* first = &adjacency[adjacencyStart[v]];
+            int* last = first + remaining[v] - 1;
+            for(int* t = first; t <= last; t++)
+                if(*t == best) {
+                    std::swap(*t, *last);
+                    break;
                 }
-			}
-			else
+            remaining[v]--;
+        }
+        for(int i = 0; i < cacheCount; i++)
+        {
+            int v = cache[i];
+            if(v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache[newCount++] = v;
+        }
+
+        // everything that fell out of the cache or moved in it gets rescored
+        for(int i = 0; i < newCount; i++)
+        {
+            int v = newCache[i];
+            cachePosition[v] = i < forsythCacheSize ? i : -1;
+            vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+        }
+        cacheCount = newCount < forsythCacheSize ? newCount : forsythCacheSize;
+        std::copy(newCache, newCache + cacheCount, cache);
+
+        best = -1;
+        float bestScore = -1.0f;
+        for(int i = 0; i < newCount; i++)
+        {
+            int v = newCache[i];
+            for(int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++)
             {
-                for(int j=0; j<3; j++) {
-                    if(normals.size() > 0) {
-                        normal = normals[faces[i]->normalIndices[j]-1];
-                        glNormal3f(normal->x,normal->y,normal->z);
-                    }
-                    if(texcoords.size() > 0) {
-                        texCoord = texcoords[faces[i]->texcoordIndices[j]-1];
-                        glTexCoord2f(texCoord->x,1-texCoord->y);
-                    }
-                    if(positions.size() > 0) {
-                        pos = positions[faces[i]->positionIndices[j]-1];
-                        glVertex3f(pos->x,pos->y,pos->z);
-                    }
+                int t = adjacency[a];
+                float score = vertexScore[idx[t*3]] + vertexScore[idx[t*3+1]] + vertexScore[idx[t*3+2]];
+                if(score > bestScore) {
+                    bestScore = score;
+                    best = t;
                 }
-			}
-		}
-		glEnd();
+            }
+        }
+    }
+    std::copy(output.begin(), output.end(), idx);
+}
+
+// Reorders the triangles of one index range into the whole vertex table,
+// through a numbering local to the range; localOf is all -1 before and after.
+static void reorderRange(unsigned int* idx, unsigned int count, vector<int>& localOf)
+{
+    vector<unsigned int> globalOf;
+    vector<unsigned int> local(count);
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(localOf[idx[i]] < 0) {
+            localOf[idx[i]] = globalOf.size();
+            globalOf.push_back(idx[i]);
+        }
+        local[i] = localOf[idx[i]];
+    }
+    forsythReorder(local.data(), count / 3, globalOf.size());
+    for(unsigned int i = 0; i < count; i++)
+        idx[i] = globalOf[local[i]];
+    for(unsigned int i = 0; i < globalOf.size(); i++)
+        localOf[globalOf[i]] = -1;
+}
+
+// Reorders each submesh's triangles for post-transform cache reuse, then
+// renumbers the vertices in first-use order so fetches walk the vertex
+// buffer front to back.
+void Mesh::optimizeVertexCache(const char *name)
+{
+    if(indices.empty())
+        return;
+    float acmrBefore = averageCacheMissRatio(indices.data(), indices.size(), vertices.size(), 16);
+
+    vector<int> localOf(vertices.size(), -1);
+    for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+        reorderRange(indices.data() + submeshes[iSubmesh].firstTriangle * 3, submeshes[iSubmesh].triangleCount * 3, localOf);
+
+    vector<int> remap(vertices.size(), -1);
+    vector<Vertex> fetchOrder;
+    fetchOrder.reserve(vertices.size());
+    for(unsigned int i = 0; i < indices.size(); i++)
+    {
+        if(remap[indices[i]] < 0) {
+            remap[indices[i]] = fetchOrder.size();
+            fetchOrder.push_back(vertices[indices[i]]);
+        }
+        indices[i] = remap[indices[i]];
+    }
+    vertices.swap(fetchOrder);
+
+    float acmrAfter = averageCacheMissRatio(indices.data(), indices.size(), vertices.size(), 16);
+    printf("%s: ACMR %.3f -> %.3f (16-entry FIFO)\n", name, acmrBefore, acmrAfter);
+}
+
+// Levels of detail: level n aims at 1/2^n of the full mesh's triangles,
+// simplified from the full mesh each time so its error is measured against
+// it, and may not move the surface more than lodMaxError of the bounding
+// radius. Vertices used by more than one submesh are locked so the pieces
+// keep meeting. The chain ends at maxLods, or at a level that saves less
+// than a fifth of the triangles of the one before.
+static const unsigned int   maxLods = 4;
+static const float          lodMaxError = 0.05f;
+
+void Mesh::buildLods(const char *name)
+{
+    lodSubmeshes.clear();
+    lodErrors.assign(1, 0.0f);
+    if(indices.empty())
+        return;
+
+    vector<float3> points(vertices.size());
+    for(unsigned int i = 0; i < vertices.size(); i++)
+        points[i] = vertices[i].position;
+
+    vector<char> locked(vertices.size(), 0);
+    vector<int> owner(vertices.size(), -1);
+    for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+    {
+        const Submesh& s = submeshes[iSubmesh];
+        for(unsigned int i = s.firstTriangle * 3; i < (s.firstTriangle + s.triangleCount) * 3; i++)
+        {
+            if(owner[indices[i]] >= 0 && owner[indices[i]] != (int)iSubmesh)
+                locked[indices[i]] = 1;
+            owner[indices[i]] = iSubmesh;
+        }
+    }
+    float maxError = boundsOf(indices.data(), indices.data() + indices.size()).radius * lodMaxError;
+
+    vector<unsigned int> simplified;
+    vector<int> localOf(vertices.size(), -1);
+    for(unsigned int lod = 1; lod < maxLods; lod++)
+    {
+        vector<Submesh> level(submeshes.size());
+        unsigned int levelTriangles = 0;
+        float levelError = 0;
+        size_t levelStart = indices.size();
+        for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+        {
+            const Submesh& full = submeshes[iSubmesh];
+            float error = MeshSimplifier::simplify(points, locked, &indices[full.firstTriangle * 3], full.triangleCount * 3,
+                                                   (full.triangleCount >> lod) * 3, maxError, simplified);
+            levelError = max(levelError, error);
+            level[iSubmesh].firstTriangle = indices.size() / 3;
+            level[iSubmesh].triangleCount = simplified.size() / 3;
+            levelTriangles += level[iSubmesh].triangleCount;
+            indices.insert(indices.end(), simplified.begin(), simplified.end());
+            if(!simplified.empty())
+                reorderRange(&indices[level[iSubmesh].firstTriangle * 3], simplified.size(), localOf);
+        }
+        if(levelTriangles > getTriangleCount(lod - 1) * 0.8f)
+        {
+            indices.resize(levelStart);
+            break;
+        }
+        lodSubmeshes.insert(lodSubmeshes.end(), level.begin(), level.end());
+        lodErrors.push_back(levelError);
+    }
+
+    printf("%s: %u levels of detail,", name, getLodCount());
+    for(unsigned int lod = 0; lod < getLodCount(); lod++)
+        printf(" %u", getTriangleCount(lod));
+    printf(" triangles, error up to %.3f\n", getLodError(getLodCount() - 1));
+}
+
+unsigned int Mesh::getLodCount() const
+{
+    return submeshes.empty() ? 1 : 1 + lodSubmeshes.size() / submeshes.size();
+}
+
+const Mesh::Submesh* Mesh::lodRange(unsigned int lod) const
+{
+    return lod == 0 ? submeshes.data() : lodSubmeshes.data() + (lod - 1) * submeshes.size();
+}
+
+unsigned int Mesh::getTriangleCount(unsigned int lod) const
+{
+    if(lod >= getLodCount())
+        return 0;
+    unsigned int count = 0;
+    const Submesh* range = lodRange(lod);
+    for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+        count += range[iSubmesh].triangleCount;
+    return count;
+}
+
+float Mesh::getLodError(unsigned int lod) const
+{
+    return lod < lodErrors.size() ? lodErrors[lod] : 0;
+}
+
+// Binary mesh cache, written next to the OBJ as <file>.meshcache after the
+// first parse. Layout: header, submesh table, level of detail table (the
+// submeshes of levels 1.., then every level's error), vertex blob, index
+// blob, each block 16-byte aligned; indices are stored at their upload width.
+// Bump meshCacheVersion whenever the layout or the mesh processing changes.
+static const char           meshCacheMagic[4] = {'T','D','M','C'};
+static const unsigned int   meshCacheVersion = 3;
+
+struct MeshCacheHeader
+{
+    char                magic[4];
+    unsigned int        version;
+    long long           sourceSize;     // size and mtime of the OBJ the cache was built from
+    long long           sourceMtime;
+    unsigned int        submeshCount;
+    unsigned int        lodCount;
+    unsigned int        vertexCount;
+    unsigned int        indexCount;
+    unsigned int        wideIndices;
+    unsigned int        submeshOffset;
+    unsigned int        lodOffset;
+    unsigned int        vertexOffset;
+    unsigned int        indexOffset;
+    unsigned int        fileSize;
+};
+
+static inline unsigned int alignTo16(size_t offset)
+{
+    return (offset + 15) & ~(size_t)15;
+}
 
-		glEndList();
-	}
+static bool sourceStamp(const char *filename, long long& size, long long& mtime)
+{
+    struct stat st;
+    if(stat(filename, &st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+static string cachePathFor(const char *filename)
+{
+    return string(filename) + ".meshcache";
 }
 
-void Mesh::draw()
+// count elements of elementSize at offset lie inside a file of fileSize bytes
+static bool blockFits(size_t offset, size_t count, size_t elementSize, size_t fileSize)
 {
-	for(int iSubmesh=0; iSubmesh<submeshFaces.size(); iSubmesh++)
-		glCallList(modelid + iSubmesh);
+    return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+// triangle ranges (Submesh) inside the index blob
+template <class Range>
+static bool rangesFit(const vector<Range>& ranges, size_t triangleCount)
+{
+    for(unsigned int i = 0; i < ranges.size(); i++)
+        if(ranges[i].firstTriangle > triangleCount || ranges[i].triangleCount > triangleCount - ranges[i].firstTriangle)
+            return false;
+    return true;
+}
+
+bool Mesh::loadCache(const char *filename)
+{
+    long long sourceSize, sourceMtime;
+    if(!sourceStamp(filename, sourceSize, sourceMtime))
+        return false;
+
+    MappedFile file;
+    if(!file.open(cachePathFor(filename).c_str()) || file.size < sizeof(MeshCacheHeader))
+        return false;
+    const MeshCacheHeader& h = *(const MeshCacheHeader*)file.data;
+    if(memcmp(h.magic, meshCacheMagic, 4) != 0 || h.version != meshCacheVersion
+       || h.sourceSize != sourceSize || h.sourceMtime != sourceMtime || h.fileSize != file.size || h.lodCount == 0)
+        return false; // stale or foreign, rebuild from the OBJ
+
+    // a damaged cache is rebuilt too: nothing is read outside the file, and
+    // no index that is out of range gets to the GPU
+    size_t indexSize = h.wideIndices ? sizeof(unsigned int) : sizeof(unsigned short);
+    size_t lodSubmeshCount = (size_t)h.submeshCount * (h.lodCount - 1);
+    if(h.submeshCount == 0 || h.lodCount > maxLods || h.wideIndices > 1 || h.indexCount % 3 != 0
+       || !blockFits(h.submeshOffset, h.submeshCount, sizeof(Submesh), file.size)
+       || !blockFits(h.lodOffset, lodSubmeshCount * sizeof(Submesh) + h.lodCount * sizeof(float), 1, file.size)
+       || !blockFits(h.vertexOffset, h.vertexCount, sizeof(Vertex), file.size)
+       || !blockFits(h.indexOffset, h.indexCount, indexSize, file.size))
+    {
+        printf("%s: mesh cache is damaged, rebuilding from the OBJ\n", filename);
+        return false;
+    }
+
+    const Submesh* s = (const Submesh*)(file.data + h.submeshOffset);
+    submeshes.assign(s, s + h.submeshCount);
+    const Submesh* l = (const Submesh*)(file.data + h.lodOffset);
+    lodSubmeshes.assign(l, l + h.submeshCount * (h.lodCount - 1));
+    const float* e = (const float*)(l + lodSubmeshes.size());
+    lodErrors.assign(e, e + h.lodCount);
+    const Vertex* v = (const Vertex*)(file.data + h.vertexOffset);
+    vertices.assign(v, v + h.vertexCount);
+    if(h.wideIndices)
+    {
+        const unsigned int* i = (const unsigned int*)(file.data + h.indexOffset);
+        indices.assign(i, i + h.indexCount);
+    }
+    else
+    {
+        const unsigned short* i = (const unsigned short*)(file.data + h.indexOffset);
+        indices.assign(i, i + h.indexCount);
+    }
+    bool valid = rangesFit(submeshes, h.indexCount / 3) && rangesFit(lodSubmeshes, h.indexCount / 3);
+    for(unsigned int i = 0; valid && i < indices.size(); i++)
+        valid = indices[i] < h.vertexCount;
+    if(!valid)
+    {
+        printf("%s: mesh cache is damaged, rebuilding from the OBJ\n", filename);
+        submeshes.clear();
+        lodSubmeshes.clear();
+        lodErrors.assign(1, 0.0f);
+        vertices.clear();
+        indices.clear();
+        return false;
+    }
+    return true;
+}
+
+void Mesh::writeCache(const char *filename)
+{
+    MeshCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    if(!sourceStamp(filename, h.sourceSize, h.sourceMtime))
+        return;
+    memcpy(h.magic, meshCacheMagic, 4);
+    h.version = meshCacheVersion;
+    h.submeshCount = submeshes.size();
+    h.lodCount = getLodCount();
+    h.vertexCount = vertices.size();
+    h.indexCount = indices.size();
+    h.wideIndices = vertices.size() > 0xffff;
+    size_t indexSize = h.wideIndices ? sizeof(unsigned int) : sizeof(unsigned short);
+    h.submeshOffset = alignTo16(sizeof(h));
+    h.lodOffset = alignTo16(h.submeshOffset + submeshes.size() * sizeof(Submesh));
+    h.vertexOffset = alignTo16(h.lodOffset + lodSubmeshes.size() * sizeof(Submesh) + h.lodCount * sizeof(float));
+    h.indexOffset = alignTo16(h.vertexOffset + vertices.size() * sizeof(Vertex));
+    h.fileSize = h.indexOffset + indices.size() * indexSize;
+
+    vector<char> blob(h.fileSize, 0);
+    memcpy(&blob[0], &h, sizeof(h));
+    if(!submeshes.empty())
+        memcpy(&blob[h.submeshOffset], submeshes.data(), submeshes.size() * sizeof(Submesh));
+    if(!lodSubmeshes.empty())
+        memcpy(&blob[h.lodOffset], lodSubmeshes.data(), lodSubmeshes.size() * sizeof(Submesh));
+    for(unsigned int lod = 0; lod < h.lodCount; lod++)
+        ((float*)&blob[h.lodOffset + lodSubmeshes.size() * sizeof(Submesh)])[lod] = getLodError(lod);
+    if(!vertices.empty())
+        memcpy(&blob[h.vertexOffset], vertices.data(), vertices.size() * sizeof(Vertex));
+    for(unsigned int i = 0; i < indices.size(); i++)
+    {
+        if(h.wideIndices)
+            ((unsigned int*)&blob[h.indexOffset])[i] = indices[i];
+        else
+            ((unsigned short*)&blob[h.indexOffset])[i] = indices[i];
+    }
+
+    // written under a temporary name so a half-written cache is never picked up
+    string path = cachePathFor(filename);
+    string tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if(!f)
+        return;
+    bool ok = fwrite(&blob[0], 1, blob.size(), f) == blob.size();
+    ok = fclose(f) == 0 && ok;
+    if(!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+        remove(tmpPath.c_str());
+}
+
+bool Mesh::useBufferObjects = true;
+
+void Mesh::setUseBufferObjects(bool use)
+{
+    useBufferObjects = use;
+}
+
+void Mesh::upload()
+{
+    ready = true;
+    if(vertices.empty())
+        return;
+    if(!useBufferObjects)
+    {
+        uploadDisplayLists();
+        return;
+    }
+
+    glGenBuffers(1, &vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    wideIndices = vertices.size() > 0xffff;
+    if(wideIndices)
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    else
+    {
+        vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// The legacy path: one display list per submesh and level of detail, level
+// by level, compiled from the same vertex table and indices with immediate
+// mode calls.
+unsigned int Mesh::displayListCount() const
+{
+    return submeshes.size() * getLodCount();
+}
+
+void Mesh::uploadDisplayLists()
+{
+    displayLists = glGenLists(displayListCount());
+    for(unsigned int iList = 0; iList < displayListCount(); iList++)
+    {
+        const Submesh& submesh = lodRange(iList / submeshes.size())[iList % submeshes.size()];
+        const unsigned int* idx = indices.data() + submesh.firstTriangle * 3;
+        const unsigned int* idxEnd = idx + submesh.triangleCount * 3;
+        glNewList(displayLists + iList, GL_COMPILE);
+        glBegin(GL_TRIANGLES);
+        for(; idx != idxEnd; idx++)
+        {
+            const Vertex& v = vertices[*idx];
+            glNormal3f(v.normal.x, v.normal.y, v.normal.z);
+            glTexCoord2f(v.texcoord.x, v.texcoord.y);
+            glVertex3f(v.position.x, v.position.y, v.position.z);
+        }
+        glEnd();
+        glEndList();
+    }
+}
+
+void Mesh::bindBuffers()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
+    glNormalPointer(GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, texcoord));
+}
+
+void Mesh::unbindBuffers()
+{
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Mesh::drawElements(const Submesh& submesh)
+{
+    size_t indexSize = wideIndices ? sizeof(unsigned int) : sizeof(unsigned short);
+    glDrawElements(GL_TRIANGLES, submesh.triangleCount * 3,
+                   wideIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+                   (const GLvoid*)(submesh.firstTriangle * 3 * indexSize));
+}
+
+// Stand-in while the mesh is still loading: its bounding box once the
+// geometry is known, a unit cube before that.
+void Mesh::drawProxy()
+{
+    glPushMatrix();
+    if(isPrepared())
+    {
+        float3 center = bounds.center;
+        float3 extent = bounds.boxMax - bounds.boxMin;
+        glTranslatef(center.x, center.y, center.z);
+        glScalef(extent.x, extent.y, extent.z);
+    }
+    glutSolidCube(1.0);
+    glPopMatrix();
+}
+
+void Mesh::draw(unsigned int lod)
+{
+    if(!ready)
+    {
+        drawProxy();
+        return;
+    }
+    lod = min(lod, getLodCount() - 1);
+    if(displayLists)
+    {
+        for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+            glCallList(displayLists + lod * submeshes.size() + iSubmesh);
+        return;
+    }
+    if(!vertexBuffer)
+        return;
+    const Submesh* range = lodRange(lod);
+    bindBuffers();
+	for(int iSubmesh=0; iSubmesh<submeshes.size(); iSubmesh++)
+		drawElements(range[iSubmesh]);
+    unbindBuffers();
+}
+
+bool Mesh::drawInstanced(unsigned int instanceCount, unsigned int lod)
+{
+    if(!ready || !vertexBuffer)
+        return false;
+    size_t indexSize = wideIndices ? sizeof(unsigned int) : sizeof(unsigned short);
+    const Submesh* range = lodRange(min(lod, getLodCount() - 1));
+    bindBuffers();
+    for(unsigned int iSubmesh = 0; iSubmesh < submeshes.size(); iSubmesh++)
+        glDrawElementsInstancedARB(GL_TRIANGLES, range[iSubmesh].triangleCount * 3,
+                                   wideIndices ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+                                   (const GLvoid*)(range[iSubmesh].firstTriangle * 3 * indexSize),
+                                   instanceCount);
+    unbindBuffers();
+    return true;
 }
 
 void Mesh::drawSubmesh(unsigned int iSubmesh)
 {
-	glCallList(modelid + iSubmesh);
+    if(iSubmesh >= submeshes.size())
+        return;
+    if(displayLists)
+    {
+        glCallList(displayLists + iSubmesh);
+        return;
+    }
+    if(!vertexBuffer)
+        return;
+    bindBuffers();
+    drawElements(submeshes[iSubmesh]);
+    unbindBuffers();
 }
 
 Mesh::~Mesh()
 {
-	for(unsigned int i = 0; i < rows.size(); i++)
-		delete rows[i];   
-	for(unsigned int i = 0; i < positions.size(); i++)
-		delete positions[i];
-	for(unsigned int i = 0; i < submeshFaces.size(); i++)
-		for(unsigned int j = 0; j < submeshFaces.at(i).size(); j++)
-			delete submeshFaces.at(i).at(j); 
-	for(unsigned int i = 0; i < normals.size(); i++)
-		delete normals[i];
-	for(unsigned int i = 0; i < texcoords.size(); i++)
-		delete texcoords[i];
+    if(vertexBuffer)
+        glDeleteBuffers(1, &vertexBuffer);
+    if(indexBuffer)
+        glDeleteBuffers(1, &indexBuffer);
+    if(displayLists)
+        glDeleteLists(displayLists, displayListCount());
+}
+
+// The loader Mesh used before the single-pass parser: every line copied into
+// its own string, then re-scanned with sscanf into one heap object per
+// vertex and face. Only kept for benchmarkLoad; returns the triangle count.
+static int legacyLoad(const char *filename)
+{
+    fstream file(filename);
+    if(!file.is_open())
+        return 0;
+
+    vector<string*> rows;
+    char buffer[256];
+    while(!file.eof())
+    {
+        file.getline(buffer,256);
+        rows.push_back(new string(buffer));
+    }
+
+    vector<float3*> positions, normals;
+    vector<float2*> texcoords;
+    vector<int*> faces;
+    vector<int> faceSizes;
+    for(int i = 0; i < rows.size(); i++)
+    {
+        const string& row = *rows[i];
+        if(row.empty() || row[0] == '#' || row[0] == 's' || row[0] == 'u')
+            continue;
+        else if(row[0] == 'v' && row[1] == ' ')
+        {
+            float x,y,z;
+            sscanf(row.c_str(), "v %f %f %f", &x,&y,&z);
+            positions.push_back(new float3(x,y,z));
+        }
+        else if(row[0] == 'v' && row[1] == 'n')
+        {
+            float x,y,z;
+            sscanf(row.c_str(), "vn %f %f %f", &x,&y,&z);
+            normals.push_back(new float3(x,y,z));
+        }
+        else if(row[0] == 'v' && row[1] == 't')
+        {
+            float x,y;
+            sscanf(row.c_str(), "vt %f %f", &x,&y);
+            texcoords.push_back(new float2(x,y));
+        }
+        else if(row[0] == 'f')
+        {
+            int* f = new int[15];
+            int numVert = -1;
+            istringstream in(row);
+            string word;
+            while(in >> word && numVert < 5) {
+                if(numVert > -1) {
+                    int* corner = f + numVert*3;
+                    int matched = sscanf(word.c_str(), "%d/%d/%d", corner, corner+1, corner+2);
+                    if(matched < 3)
+                        matched = sscanf(word.c_str(), "%d//%d", corner, corner+2);
+                    if(matched < 2)
+                        matched = sscanf(word.c_str(), "%d/%d", corner, corner+1);
+                }
+                numVert++;
+            }
+            faces.push_back(f);
+            faceSizes.push_back(numVert);
+        }
+    }
+
+    int triangleCount = 0;
+    for(int i = 0; i < faceSizes.size(); i++)
+        triangleCount += faceSizes[i] - 2;
+    for(int i = 0; i < rows.size(); i++) delete rows[i];
+    for(int i = 0; i < positions.size(); i++) delete positions[i];
+    for(int i = 0; i < normals.size(); i++) delete normals[i];
+    for(int i = 0; i < texcoords.size(); i++) delete texcoords[i];
+    for(int i = 0; i < faces.size(); i++) delete [] faces[i];
+    return triangleCount;
+}
+
+void Mesh::benchmarkLoad(const char *filename, int runs)
+{
+    typedef chrono::high_resolution_clock Clock;
+    double legacyMs = 0, singlePassMs = 0;
+    int legacyFaces = 0, singlePassFaces = 0;
+
+    for(int r = 0; r < runs; r++)
+    {
+        Clock::time_point t0 = Clock::now();
+        legacyFaces = legacyLoad(filename);
+        Clock::time_point t1 = Clock::now();
+        {
+            Mesh m;
+            m.load(filename);
+            singlePassFaces = m.corners.size() / 3;
+        }
+        Clock::time_point t2 = Clock::now();
+        legacyMs += chrono::duration<double, milli>(t1 - t0).count();
+        singlePassMs += chrono::duration<double, milli>(t2 - t1).count();
+    }
+
+    printf("%s: %d triangles, legacy %.2f ms, single-pass %.2f ms (%.1fx)\n",
+           filename, singlePassFaces, legacyMs / runs, singlePassMs / runs,
+           singlePassMs > 0 ? legacyMs / singlePassMs : 0.0);
+    if(legacyFaces != singlePassFaces)
+        printf("  warning: legacy loader saw %d triangles\n", legacyFaces);
+}
+
+void Mesh::benchmarkParse(const char *name, const char *data, size_t size, int maxThreads, int runs)
+{
+    typedef chrono::high_resolution_clock Clock;
+    Mesh serial;
+    serial.parse(data, size, name, 1);
+    printf("%s: %.1f MB, %d triangles\n", name, size / 1048576.0, (int)serial.corners.size() / 3);
+
+    double serialMs = 0;
+    for(int threads = 1; threads <= maxThreads; threads++)
+    {
+        double ms = 0;
+        bool identical = true;
+        for(int r = 0; r < runs; r++)
+        {
+            Clock::time_point t0 = Clock::now();
+            Mesh m;
+            m.parse(data, size, name, threads);
+            ms += chrono::duration<double, milli>(Clock::now() - t0).count();
+
+            identical = identical
+                && m.positions.size() == serial.positions.size()
+                && m.normals.size() == serial.normals.size()
+                && m.texcoords.size() == serial.texcoords.size()
+                && m.corners.size() == serial.corners.size()
+                && m.submeshes.size() == serial.submeshes.size()
+                && memcmp(m.positions.data(), serial.positions.data(), m.positions.size() * sizeof(float3)) == 0
+                && memcmp(m.normals.data(), serial.normals.data(), m.normals.size() * sizeof(float3)) == 0
+                && memcmp(m.texcoords.data(), serial.texcoords.data(), m.texcoords.size() * sizeof(float2)) == 0
+                && memcmp(m.corners.data(), serial.corners.data(), m.corners.size() * sizeof(Corner)) == 0
+                && memcmp(m.submeshes.data(), serial.submeshes.data(), m.submeshes.size() * sizeof(Submesh)) == 0;
+        }
+        ms /= runs;
+        if(threads == 1)
+            serialMs = ms;
+        printf("  %2d threads: %8.2f ms  %5.2fx  %s\n", threads, ms, serialMs / ms,
+               identical ? "identical" : "MISMATCH");
+    }
+}
+
+void Mesh::benchmarkParseThreads(const char *filename, int maxThreads, int runs)
+{
+    MappedFile file;
+    if(!file.open(filename))
+    {
+        printf("file %s not found\n", filename);
+        return;
+    }
+    benchmarkParse(filename, file.data, file.size, maxThreads, runs);
+}
+
+// A gridSize x gridSize patch (2 * gridSize^2 triangles). Rows of vertices are
+// interleaved with the faces that use them, every other row of faces uses
+// negative indices, and each row is its own group, so slice boundaries land
+// between relative references and submesh breaks.
+void Mesh::benchmarkParseSynthetic(int gridSize, int maxThreads, int runs)
+{
+    string obj;
+    obj.reserve((size_t)gridSize * gridSize * 150);
+    char line[160];
+    int row = gridSize + 1;
+    for(int z = 0; z <= gridSize; z++)
+    {
+        for(int x = 0; x <= gridSize; x++)
+        {
+            float h = sinf(x * 0.1f) * cosf(z * 0.1f);
+            obj.append(line, snprintf(line, sizeof(line), "v %f %f %f\nvt %f %f\nvn 0 1 0\n",
+                                      (float)x, h, (float)z, x / (float)gridSize, z / (float)gridSize));
+        }
+        if(z == 0)
+            continue;
+        obj.append("g row\n");
+        for(int x = 0; x < gridSize; x++)
+        {
+            // 1-based ids of the quad's corners on the previous and the current row
+            int a = (z - 1) * row + x + 1, b = a + 1, c = a + row, d = c + 1;
+            if(z % 2)
+                obj.append(line, snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\nf %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                                          a,a,a, c,c,c, b,b,b, b,b,b, c,c,c, d,d,d));
+            else
+            {
+                int n = (z + 1) * row; // vertices read so far
+                a -= n + 1; b -= n + 1; c -= n + 1; d -= n + 1;
+                obj.append(line, snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                                          a,a,a, c,c,c, d,d,d, b,b,b));
+            }
+        }
+    }
+    snprintf(line, sizeof(line), "synthetic %dx%d grid", gridSize, gridSize);
+    benchmarkParse(line, obj.data(), obj.size(), maxThreads, runs);
 }
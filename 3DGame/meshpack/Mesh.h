@@ -2,31 +2,136 @@
 #include "float2.h"
 #include "float3.h"
 #include <vector>
+#include <string>
+#include <atomic>
 
 class   Mesh
 {
-	struct  Face
+public:
+    // a box and a sphere around it in model space, valid once prepared
+    struct  Bounds
+    {
+        float3    boxMin;
+        float3    boxMax;
+        float3    center;
+        float     radius;
+    };
+
+private:
+	// one triangle corner, 0-based indices into the attribute arrays (-1 if absent)
+	struct  Corner
+	{
+		int       position;
+		int       texcoord;
+		int       normal;
+	};
+
+	// a run of consecutive triangles started by a 'g' line
+	struct  Submesh
 	{
-		int       positionIndices[5];
-		int       normalIndices[5];
-		int       texcoordIndices[5];
-		bool      isQuad;
-        bool      isPentagon;
+		unsigned int    firstTriangle;
+		unsigned int    triangleCount;
 	};
 
-	std::vector<std::string*>	rows;
-	std::vector<float3*>		positions;
-	std::vector<std::vector<Face*> >          submeshFaces;
-	std::vector<float3*>		normals;
-	std::vector<float2*>		texcoords;
+	std::vector<float3>		positions;
+	std::vector<float3>		normals;
+	std::vector<float2>		texcoords;
+	std::vector<Corner>		corners;        // three per triangle, all submeshes back to back
+	std::vector<Submesh>	submeshes;      // level of detail 0, the mesh as loaded
+	std::vector<Submesh>	lodSubmeshes;   // levels 1.., submeshes.size() per level, their triangles after level 0's
+	std::vector<float>		lodErrors;      // per level, how far it strays from level 0 in model units
+
+	// interleaved vertex as laid out in the vertex buffer
+	struct  Vertex
+	{
+		float3    position;
+		float3    normal;
+		float2    texcoord;
+	};
+
+	std::vector<Vertex>         vertices;       // unique (position, normal, texcoord) combinations
+	std::vector<unsigned int>   indices;        // three per triangle, same submesh ranges as corners
+
+	std::string    filename;
+	Bounds         bounds;
+	std::vector<Bounds>    submeshBounds;
 
-	int            modelid;
+	unsigned int   vertexBuffer;
+	unsigned int   indexBuffer;
+	unsigned int   displayLists;                // legacy path only, first of one list per submesh
+	bool           wideIndices;                 // 32-bit indices, more than 65535 vertices
+	std::atomic<bool>   prepared;               // CPU side done, set by the loading thread
+	bool           ready;                       // uploaded, only touched on the GL thread
+
+    struct      ObjChunk;
+    static void parseChunk(const char *begin, const char *end, ObjChunk& out, const char *filename);
+    void        mergeChunk(ObjChunk& chunk, size_t positionBase, size_t normalBase, size_t texcoordBase, size_t cornerBase);
+
+    Mesh();
+    // threads <= 0 picks a count from the file size
+    bool        load(const char *filename, int threads = 0);
+    void        parse(const char *data, size_t size, const char *name, int threads);
+    void        buildVertices(const char *name);
+    void        optimizeVertexCache(const char *name);
+    void        buildLods(const char *name);
+    const Submesh*  lodRange(unsigned int lod) const;
+    void        computeBounds();
+    Bounds      boundsOf(const unsigned int *index, const unsigned int *indexEnd) const;
+    bool        loadCache(const char *filename);
+    void        writeCache(const char *filename);
+    void        uploadDisplayLists();
+    void        bindBuffers();
+    void        unbindBuffers();
+    void        drawElements(const Submesh& submesh);
+    unsigned int    displayListCount() const;
+    void        drawProxy();
 
 public:
+    // only records the file; prepare() and upload() do the loading
     Mesh(const char *filename);
 	~Mesh();
 
-	void        draw();
+    // reads the mesh cache or parses the OBJ, safe to run off the GL thread
+    void        prepare();
+    // creates the GL buffers, needs the GL context
+    void        upload();
+    bool        isPrepared() const;
+    bool        isReady() const { return ready; }
+
+    const Bounds&   getBounds() const { return bounds; }
+    unsigned int    getSubmeshCount() const { return submeshes.size(); }
+    const Bounds&   getSubmeshBounds(unsigned int iSubmesh) const { return submeshBounds[iSubmesh]; }
+
+    // levels of detail, 0 the full mesh; each has about half the triangles of the one before
+    unsigned int    getLodCount() const;
+    unsigned int    getTriangleCount(unsigned int lod) const;
+    // largest distance a level's surface moved from the full mesh, in model units
+    float           getLodError(unsigned int lod) const;
+
+	// draws a bounding box proxy until the mesh is uploaded; lods past the last draw the last
+	void        draw(unsigned int lod = 0);
 	void        drawSubmesh(unsigned int iSubmesh);
+    // all submeshes, instanceCount times, with one glDrawElementsInstanced per
+    // submesh; per-instance attributes must already be set up. False if the
+    // mesh is not uploaded to buffer objects (still loading, or legacy path).
+    bool        drawInstanced(unsigned int instanceCount, unsigned int lod = 0);
+
+    // unique vertices per triangle corner, 1 means nothing was shared
+    float       uniqueVertexRatio() const;
+
+    // a prepared UV sphere, not yet uploaded
+    static Mesh* createSphere(float radius, int slices, int stacks);
+
+    // buffer objects (default) or the legacy display lists, for meshes uploaded from now on
+    static void setUseBufferObjects(bool use);
+
+    // times the single-pass parser against the old row + sscanf loader (no GL needed)
+    static void benchmarkLoad(const char *filename, int runs);
+    // parse time on 1..maxThreads threads, checking every run against the serial result
+    static void benchmarkParseThreads(const char *filename, int maxThreads, int runs);
+    static void benchmarkParseSynthetic(int gridSize, int maxThreads, int runs);
+private:
+    static bool useBufferObjects;
+    static void benchmarkParse(const char *name, const char *data, size_t size, int maxThreads, int runs);
 };
 
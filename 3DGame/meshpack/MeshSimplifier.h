@@ -0,0 +1,347 @@
+#pragma once
+#include "float3.h"
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+// Quadric error metric simplification (Garland & Heckbert, "Surface
+// Simplification Using Quadric Error Metrics", 1997) by half-edge collapse:
+// vertices only ever move onto a neighbour, so the result indexes the same
+// vertex table as the input and a level of detail is just another index
+// range.
+// Collapses work on positions. The vertices at one position (split by UV or
+// normal seams, or the two sides of double-sided geometry) move together,
+// each onto the one vertex at the target position it shares a triangle
+// with; a collapse where that is not clear-cut is skipped, which keeps seams
+// from being torn open. A position on a border (an edge only one triangle of
+// its vertices uses, be it an open edge or a seam) may only slide along
+// that border, and the border edges add planes at right angles to their
+// triangle to the quadrics, so borders and seams keep their shape.
+// Every position keeps the sum of the planes around it, weighted by area;
+// collapsing a onto b costs the mean squared distance of b from the planes
+// of both, and b takes over a's planes. Collapses go in passes, cheapest
+// first, each pass touching a neighbourhood at most once, and a collapse
+// that would turn a triangle too far is skipped.
+class MeshSimplifier
+{
+    // symmetric 4x4 plane quadric, upper triangle, and the area it was built from
+    struct Quadric
+    {
+        double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+        double weight;
+
+        Quadric():a00(0),a01(0),a02(0),a03(0),a11(0),a12(0),a13(0),a22(0),a23(0),a33(0),weight(0){}
+
+        // the plane n.p + d = 0, n of unit length
+        void addPlane(const float3& n, double d, double w)
+        {
+            a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+            a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+            a22 += w * n.z * n.z; a23 += w * n.z * d;
+            a33 += w * d * d;
+            weight += w;
+        }
+
+        void operator+=(const Quadric& o)
+        {
+            a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+            a11 += o.a11; a12 += o.a12; a13 += o.a13;
+            a22 += o.a22; a23 += o.a23;
+            a33 += o.a33;
+            weight += o.weight;
+        }
+
+        // weighted sum of squared distances of p from the planes
+        double evaluate(const float3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x
+                     + a11*y*y + 2*a12*y*z + 2*a13*y
+                     + a22*z*z + 2*a23*z
+                     + a33;
+            return e > 0 ? e : 0;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from;      // positions
+        unsigned int to;
+        double cost;            // mean squared distance
+        bool operator<(const Collapse& o) const { return cost < o.cost; }
+    };
+
+    // orders vertex ids by the bytes of their positions
+    struct PositionLess
+    {
+        const float3* positions;
+        bool operator()(unsigned int a, unsigned int b) const
+        {
+            return memcmp(&positions[a], &positions[b], sizeof(float3)) < 0;
+        }
+    };
+
+    static unsigned long long edgeKey(unsigned int a, unsigned int b)
+    {
+        return a < b ? (unsigned long long)a << 32 | b : (unsigned long long)b << 32 | a;
+    }
+
+    static float3 triangleNormal(const float3& a, const float3& b, const float3& c)
+    {
+        return (b - a).cross(c - a);
+    }
+
+    // a collapse may not turn a triangle by more than about 75 degrees
+    static bool turnsTooFar(const float3& before, const float3& after)
+    {
+        double dot = before.dot(after);
+        return dot <= 0 || dot * dot < 0.0625 * before.norm2() * after.norm2();
+    }
+
+public:
+    // Simplifies the triangles in indices[0..indexCount) towards
+    // targetIndexCount indices, never moving the surface further than
+    // maxError (model units, as a root mean square distance from the planes
+    // it came from), and writes them to result. Vertices marked locked stay
+    // where they are, and so does everything at their position. Returns the
+    // largest error accepted.
+    static float simplify(const std::vector<float3>& positions, const std::vector<char>& locked,
+                          const unsigned int* indices, size_t indexCount, size_t targetIndexCount,
+                          float maxError, std::vector<unsigned int>& result)
+    {
+        result.assign(indices, indices + indexCount);
+        unsigned int vertexCount = positions.size();
+
+        // vertices at the same position, in runs; groupOf is the run's first vertex
+        std::vector<unsigned int> byPosition(vertexCount);
+        for(unsigned int v = 0; v < vertexCount; v++)
+            byPosition[v] = v;
+        PositionLess less = { positions.data() };
+        std::sort(byPosition.begin(), byPosition.end(), less);
+        std::vector<unsigned int> groupOf(vertexCount);
+        std::vector<unsigned int> groupStart(vertexCount, 0);   // into byPosition, for a group's first vertex
+        std::vector<unsigned int> groupSize(vertexCount, 0);
+        for(unsigned int i = 0; i < vertexCount; i++)
+        {
+            unsigned int v = byPosition[i];
+            if(i > 0 && !less(byPosition[i - 1], v))
+                groupOf[v] = groupOf[byPosition[i - 1]];
+            else
+            {
+                groupOf[v] = v;
+                groupStart[v] = i;
+            }
+            groupSize[groupOf[v]]++;
+        }
+
+        std::vector<char> pinned(vertexCount, 0);
+        for(unsigned int v = 0; v < locked.size() && v < vertexCount; v++)
+            if(locked[v])
+                pinned[groupOf[v]] = 1;
+
+        std::vector<Quadric> quadrics(vertexCount);
+        for(size_t i = 0; i + 2 < result.size(); i += 3)
+        {
+            const float3& p0 = positions[result[i]];
+            float3 n = triangleNormal(p0, positions[result[i + 1]], positions[result[i + 2]]);
+            float area2 = n.norm();
+            if(area2 <= 0)
+                continue;
+            n = n * (1 / area2);
+            double d = -n.dot(p0);
+            for(int k = 0; k < 3; k++)
+                quadrics[groupOf[result[i + k]]].addPlane(n, d, area2 * 0.5);
+        }
+
+        double maxCost = (double)maxError * maxError;
+        double acceptedCost = 0;
+        std::vector<unsigned int> remap(vertexCount);
+        std::vector<char> touched(vertexCount);
+        std::vector<unsigned int> adjacencyStart(vertexCount + 1);
+        std::vector<unsigned int> adjacency;
+        std::vector<unsigned long long> edges;
+        std::vector<unsigned long long> borderEdges;
+        std::vector<unsigned char> borderCount(vertexCount);
+        std::vector<char> onBorder(vertexCount);
+        std::vector<Collapse> collapses;
+        std::vector<unsigned int> partners;
+        bool firstPass = true;
+
+        while(result.size() > targetIndexCount)
+        {
+            size_t triangleCount = result.size() / 3;
+
+            // triangles around each vertex
+            std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+            for(size_t i = 0; i < result.size(); i++)
+                adjacencyStart[result[i] + 1]++;
+            for(unsigned int v = 0; v < vertexCount; v++)
+                adjacencyStart[v + 1] += adjacencyStart[v];
+            adjacency.resize(result.size());
+            std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+            for(size_t i = 0; i < result.size(); i++)
+                adjacency[fill[result[i]]++] = i / 3;
+
+            // border edges: only one triangle has them
+            edges.clear();
+            for(size_t i = 0; i < result.size(); i += 3)
+                for(int k = 0; k < 3; k++)
+                    edges.push_back(edgeKey(result[i + k], result[i + (k + 1) % 3]));
+            std::sort(edges.begin(), edges.end());
+            borderEdges.clear();
+            for(size_t i = 0; i < edges.size(); )
+            {
+                size_t j = i + 1;
+                while(j < edges.size() && edges[j] == edges[i])
+                    j++;
+                if(j - i == 1)
+                    borderEdges.push_back(edges[i]);
+                i = j;
+            }
+            std::fill(borderCount.begin(), borderCount.end(), 0);
+            std::fill(onBorder.begin(), onBorder.end(), 0);
+            for(size_t i = 0; i < borderEdges.size(); i++)
+            {
+                unsigned int a = borderEdges[i] >> 32, b = borderEdges[i] & 0xffffffffu;
+                borderCount[a] = std::min(borderCount[a] + 1, 255);
+                borderCount[b] = std::min(borderCount[b] + 1, 255);
+                onBorder[groupOf[a]] = onBorder[groupOf[b]] = 1;
+            }
+            // planes standing on the borders, so sliding along one keeps it straight
+            if(firstPass)
+            {
+                for(size_t i = 0; i < result.size(); i += 3)
+                    for(int k = 0; k < 3; k++)
+                    {
+                        unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+                        if(!std::binary_search(borderEdges.begin(), borderEdges.end(), edgeKey(a, b)))
+                            continue;
+                        float3 n = triangleNormal(positions[result[i]], positions[result[i + 1]], positions[result[i + 2]]);
+                        float3 edge = positions[b] - positions[a];
+                        float3 side = edge.cross(n);
+                        if(side.norm2() <= 0)
+                            continue;
+                        side = side * (1 / side.norm());
+                        double w = edge.norm2() * 10;
+                        quadrics[groupOf[a]].addPlane(side, -side.dot(positions[a]), w);
+                        quadrics[groupOf[b]].addPlane(side, -side.dot(positions[a]), w);
+                    }
+                firstPass = false;
+            }
+
+            collapses.clear();
+            for(size_t i = 0; i < result.size(); i += 3)
+                for(int k = 0; k < 3; k++)
+                {
+                    unsigned int a = groupOf[result[i + k]], b = groupOf[result[i + (k + 1) % 3]];
+                    for(int direction = 0; direction < 2; direction++, std::swap(a, b))
+                    {
+                        if(a == b || pinned[a])
+                            continue;
+                        Quadric q = quadrics[a];
+                        q += quadrics[b];
+                        Collapse c = { a, b, q.weight > 0 ? q.evaluate(positions[b]) / q.weight : 0 };
+                        if(c.cost <= maxCost)
+                            collapses.push_back(c);
+                    }
+                }
+            if(collapses.empty())
+                break;
+            std::sort(collapses.begin(), collapses.end());
+
+            for(unsigned int v = 0; v < vertexCount; v++)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), 0);
+            size_t removable = triangleCount - targetIndexCount / 3;
+            size_t removed = 0;
+            for(size_t iCollapse = 0; iCollapse < collapses.size() && removed < removable; iCollapse++)
+            {
+                const Collapse& c = collapses[iCollapse];
+                if(touched[c.from] || touched[c.to])
+                    continue;
+                const unsigned int* variants = &byPosition[groupStart[c.from]];
+                unsigned int variantCount = groupSize[c.from];
+
+                // each vertex at from needs exactly one vertex at to it shares a triangle with
+                bool valid = true;
+                partners.assign(variantCount, vertexCount);
+                for(unsigned int iVariant = 0; iVariant < variantCount && valid; iVariant++)
+                {
+                    unsigned int x = variants[iVariant];
+                    for(unsigned int t = adjacencyStart[x]; t < adjacencyStart[x + 1] && valid; t++)
+                        for(int k = 0; k < 3; k++)
+                        {
+                            unsigned int y = result[adjacency[t] * 3 + k];
+                            if(groupOf[y] != c.to)
+                                continue;
+                            if(partners[iVariant] != vertexCount && partners[iVariant] != y)
+                                valid = false;
+                            partners[iVariant] = y;
+                        }
+                    if(partners[iVariant] == vertexCount && adjacencyStart[x + 1] > adjacencyStart[x])
+                        valid = false;
+                    // on a border, only along it, and not from a corner
+                    if(valid && onBorder[c.from] && partners[iVariant] != vertexCount)
+                        valid = borderCount[x] == 2
+                            && std::binary_search(borderEdges.begin(), borderEdges.end(), edgeKey(x, partners[iVariant]));
+                }
+                if(!valid)
+                    continue;
+
+                // the triangles that stay must keep facing about the same way
+                unsigned int dying = 0;
+                for(unsigned int iVariant = 0; iVariant < variantCount && valid; iVariant++)
+                {
+                    unsigned int x = variants[iVariant];
+                    for(unsigned int t = adjacencyStart[x]; t < adjacencyStart[x + 1] && valid; t++)
+                    {
+                        const unsigned int* tri = &result[adjacency[t] * 3];
+                        if(tri[0] == partners[iVariant] || tri[1] == partners[iVariant] || tri[2] == partners[iVariant])
+                        {
+                            dying++;
+                            continue;
+                        }
+                        float3 corners[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+                        float3 before = triangleNormal(corners[0], corners[1], corners[2]);
+                        for(int k = 0; k < 3; k++)
+                            if(tri[k] == x)
+                                corners[k] = positions[c.to];
+                        valid = !turnsTooFar(before, triangleNormal(corners[0], corners[1], corners[2]));
+                    }
+                }
+                if(!valid)
+                    continue;
+
+                for(unsigned int iVariant = 0; iVariant < variantCount; iVariant++)
+                {
+                    unsigned int x = variants[iVariant];
+                    if(partners[iVariant] != vertexCount)
+                        remap[x] = partners[iVariant];
+                    // everything around from changes shape, leave it to the next pass
+                    for(unsigned int t = adjacencyStart[x]; t < adjacencyStart[x + 1]; t++)
+                        for(int k = 0; k < 3; k++)
+                            touched[groupOf[result[adjacency[t] * 3 + k]]] = 1;
+                }
+                quadrics[c.to] += quadrics[c.from];
+                acceptedCost = std::max(acceptedCost, c.cost);
+                removed += dying;
+            }
+            if(removed == 0)
+                break;
+
+            size_t kept = 0;
+            for(size_t i = 0; i < result.size(); i += 3)
+            {
+                unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+                if(a == b || b == c || c == a)
+                    continue;
+                result[kept++] = a;
+                result[kept++] = b;
+                result[kept++] = c;
+            }
+            result.resize(kept);
+        }
+        return (float)sqrt(acceptedCost);
+    }
+};